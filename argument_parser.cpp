@@ -10,9 +10,45 @@
 #include <string>
 #include <stdexcept>
 #include <iostream>
+#include <cstdint>
 #include "argument_parser.hpp"
-#include "flow_table.hpp"
+#include "flow_types.hpp"
 
+#define DEFAULT_MAX_FLOWS 65536
+#define DEFAULT_TOP_FLOWS 10
+#define MAX_THREADS 64
+#define DEFAULT_BLOCK_SIZE 1024 // KiB
+#define DEFAULT_BLOCK_COUNT 32
+#define DEFAULT_SNAPLEN 128     // octets, enough for link, network and transport headers
+#define MAX_SNAPLEN 262144      // octets
+#define DEFAULT_TIMEOUT 1000    // ms
+#define DEFAULT_IDLE_TIMEOUT 60 // s
+#define MAX_SKETCH_COUNTERS (1 << 24)
+#define MAX_IDLE_TIMEOUT 86400  // s
+#define MAX_REFRESH_TIME 86400  // s
+#define MAX_ROTATE_SIZE (1024 * 1024) // MiB
+#define MAX_ROTATE_INTERVAL 604800    // s
+#define MAX_FSYNC_PERIODS 86400
+
+/**
+ * @brief Convert option value to integer in range 1 - max.
+ * 
+ * @param value option value
+ * @param max maximal accepted value
+ * @param error message of the exception thrown for invalid value
+ * @return long long 
+ */
+static long long parseCount(const std::string &value, long long max, const char *error)
+{
+    try {
+        size_t parsed = 0;
+        long long count = std::stoll(value, &parsed);
+        if (parsed == value.size() && count > 0 && count <= max)
+            return count;
+    } catch (const std::exception& exc) {
+    }
+    throw std::invalid_argument(error);
+}
 
 Config parseArgs(int argc, char *argv[])
 {
@@ -20,10 +56,51 @@ Config parseArgs(int argc, char *argv[])
     config.sort_key = SortKey::BYTES;
     config.outDirector = "";
     config.refresh_time = 1;
+    config.max_flows = DEFAULT_MAX_FLOWS;
+    config.top_flows = DEFAULT_TOP_FLOWS;
+    config.cumulative = false;
+    config.sketch_counters = 0;
+    config.format = OutputFormat::TERMINAL;
+    config.output = nullptr;
+    config.metrics_listen = nullptr;
+    config.stats = false;
+    config.idle_timeout = DEFAULT_IDLE_TIMEOUT;
+    config.capture.interface = nullptr;
+    config.capture.file = nullptr;
+    config.capture.paced = false;
+    config.capture.filter = nullptr;
+    config.capture.threads = 1;
+    config.capture.backend = CaptureBackend::PCAP;
+    config.capture.block_size = DEFAULT_BLOCK_SIZE * 1024;
+    config.capture.block_count = DEFAULT_BLOCK_COUNT;
+    config.capture.snaplen = DEFAULT_SNAPLEN;
+    config.capture.buffer_size = 0;
+    config.capture.immediate = false;
+    config.capture.timeout = DEFAULT_TIMEOUT;
+    config.capture.timed = false;
     bool sort_key_set = false;
     bool iface_set = false;
+    bool file_set = false;
+    bool filter_set = false;
     bool out_set = false;
     bool refresh_set = false;
+    bool max_flows_set = false;
+    bool top_flows_set = false;
+    bool threads_set = false;
+    bool backend_set = false;
+    bool block_size_set = false;
+    bool block_count_set = false;
+    bool snaplen_set = false;
+    bool buffer_size_set = false;
+    bool timeout_set = false;
+    bool idle_timeout_set = false;
+    bool sketch_set = false;
+    bool format_set = false;
+    bool output_set = false;
+    bool rotate_size_set = false;
+    bool rotate_interval_set = false;
+    bool fsync_set = false;
+    bool metrics_set = false;
     
 
     for (int i = 1; i < argc; i++)
@@ -43,7 +120,7 @@ Config parseArgs(int argc, char *argv[])
             }
             if (i < (argc - 1))
             {
-                config.interface = argv[++i];
+                config.capture.interface = argv[++i];
                 iface_set = true;
             }
             else
@@ -51,6 +128,42 @@ Config parseArgs(int argc, char *argv[])
                 throw std::invalid_argument("Missing interface name after -i");
             }
         }
+        else if (arg == "-r") // capture file
+        {
+            if (file_set)
+            {
+                throw std::invalid_argument("Capture file already specified");
+            }
+            if (i < (argc - 1))
+            {
+                config.capture.file = argv[++i];
+                file_set = true;
+            }
+            else
+            {
+                throw std::invalid_argument("Missing file name after -r");
+            }
+        }
+        else if (arg == "-f") // pcap filter expression
+        {
+            if (filter_set)
+            {
+                throw std::invalid_argument("Filter already specified");
+            }
+            if (i < (argc - 1))
+            {
+                config.capture.filter = argv[++i];
+                filter_set = true;
+            }
+            else
+            {
+                throw std::invalid_argument("Missing filter expression after -f");
+            }
+        }
+        else if (arg == "--pace") // replay capture file in periods given by timestamps
+        {
+            config.capture.paced = true;
+        }
         else if (arg == "-s") // sort
         {
             if (sort_key_set)
@@ -102,17 +215,321 @@ Config parseArgs(int argc, char *argv[])
             }
             if (i < (argc - 1))
             {
-                std::string time = argv[++i];
-                try {
-                   config.refresh_time = std::stoi(time); // Converts the string to an integer
-                } catch (const std::exception& exc) {
-                    throw std::invalid_argument("Refresh period must be integer.");
-                }
+                config.refresh_time = parseCount(argv[++i], MAX_REFRESH_TIME, "Refresh period must be integer in range 1-86400.");
                 refresh_set = true;
             }
             else
             {
-                throw std::invalid_argument("Missing directory path after -d");
+                throw std::invalid_argument("Missing period after -t");
+            }
+        }
+        else if (arg == "-n") // number of displayed flows
+        {
+            if (top_flows_set)
+            {
+                throw std::invalid_argument("Number of displayed flows already specified");
+            }
+            if (i < (argc - 1))
+            {
+                config.top_flows = parseCount(argv[++i], UINT32_MAX, "Number of displayed flows must be positive integer.");
+                top_flows_set = true;
+            }
+            else
+            {
+                throw std::invalid_argument("Missing count after -n");
+            }
+        }
+        else if (arg == "-j") // number of capture threads
+        {
+            if (threads_set)
+            {
+                throw std::invalid_argument("Number of capture threads already specified");
+            }
+            if (i < (argc - 1))
+            {
+                config.capture.threads = parseCount(argv[++i], MAX_THREADS, "Number of capture threads must be integer in range 1-64.");
+                threads_set = true;
+            }
+            else
+            {
+                throw std::invalid_argument("Missing count after -j");
+            }
+        }
+        else if (arg == "--max-flows") // capacity of the flow table
+        {
+            if (max_flows_set)
+            {
+                throw std::invalid_argument("Maximal number of flows already specified");
+            }
+            if (i < (argc - 1))
+            {
+                config.max_flows = parseCount(argv[++i], UINT32_MAX / 2, "Maximal number of flows must be positive integer.");
+                max_flows_set = true;
+            }
+            else
+            {
+                throw std::invalid_argument("Missing count after --max-flows");
+            }
+        }
+        else if (arg == "--cumulative") // keep flows across periods
+        {
+            config.cumulative = true;
+        }
+        else if (arg == "--idle-timeout") // forget flows idle for given seconds in cumulative mode
+        {
+            if (idle_timeout_set)
+            {
+                throw std::invalid_argument("Idle timeout already specified");
+            }
+            if (i < (argc - 1))
+            {
+                config.idle_timeout = parseCount(argv[++i], MAX_IDLE_TIMEOUT, "Idle timeout must be integer in range 1-86400 (s).");
+                idle_timeout_set = true;
+            }
+            else
+            {
+                throw std::invalid_argument("Missing time after --idle-timeout");
+            }
+        }
+        else if (arg == "--sketch") // track top flows in fixed memory
+        {
+            if (sketch_set)
+            {
+                throw std::invalid_argument("Sketch size already specified");
+            }
+            if (i < (argc - 1))
+            {
+                config.sketch_counters = parseCount(argv[++i], MAX_SKETCH_COUNTERS, "Sketch size must be integer in range 1-16777216.");
+                sketch_set = true;
+            }
+            else
+            {
+                throw std::invalid_argument("Missing count after --sketch");
+            }
+        }
+        else if (arg == "--format") // headless output of the records
+        {
+            if (format_set)
+            {
+                throw std::invalid_argument("Output format already specified");
+            }
+            if (i < (argc - 1))
+            {
+                std::string format = argv[++i];
+                if (format == "jsonl")
+                {
+                    config.format = OutputFormat::JSONL;
+                }
+                else if (format == "csv")
+                {
+                    config.format = OutputFormat::CSV;
+                }
+                else
+                {
+                    throw std::invalid_argument("Output format must be jsonl or csv.");
+                }
+                format_set = true;
+            }
+            else
+            {
+                throw std::invalid_argument("Missing format after --format");
+            }
+        }
+        else if (arg == "-o") // file the records are written to
+        {
+            if (output_set)
+            {
+                throw std::invalid_argument("Output file already specified");
+            }
+            if (i < (argc - 1))
+            {
+                config.output = argv[++i];
+                output_set = true;
+            }
+            else
+            {
+                throw std::invalid_argument("Missing file name after -o");
+            }
+        }
+        else if (arg == "--rotate-size") // rotate the output file before it grows beyond given MiB
+        {
+            if (rotate_size_set)
+            {
+                throw std::invalid_argument("Rotation size already specified");
+            }
+            if (i < (argc - 1))
+            {
+                config.export_options.rotate_size = parseCount(argv[++i], MAX_ROTATE_SIZE, "Rotation size must be integer in range 1-1048576 (MiB).") * 1024 * 1024;
+                rotate_size_set = true;
+            }
+            else
+            {
+                throw std::invalid_argument("Missing size after --rotate-size");
+            }
+        }
+        else if (arg == "--rotate-interval") // rotate the output file every given seconds
+        {
+            if (rotate_interval_set)
+            {
+                throw std::invalid_argument("Rotation interval already specified");
+            }
+            if (i < (argc - 1))
+            {
+                config.export_options.rotate_interval = parseCount(argv[++i], MAX_ROTATE_INTERVAL, "Rotation interval must be integer in range 1-604800 (s).");
+                rotate_interval_set = true;
+            }
+            else
+            {
+                throw std::invalid_argument("Missing time after --rotate-interval");
+            }
+        }
+        else if (arg == "--fsync") // sync the output file once per given periods
+        {
+            if (fsync_set)
+            {
+                throw std::invalid_argument("Sync interval already specified");
+            }
+            if (i < (argc - 1))
+            {
+                config.export_options.fsync_periods = parseCount(argv[++i], MAX_FSYNC_PERIODS, "Sync interval must be integer in range 1-86400 (periods).");
+                fsync_set = true;
+            }
+            else
+            {
+                throw std::invalid_argument("Missing count after --fsync");
+            }
+        }
+        else if (arg == "--stats") // pipeline counters of every period
+        {
+            config.stats = true;
+            config.capture.timed = true; // per-packet clock reads cost throughput, only on request
+        }
+        else if (arg == "--metrics-listen") // serve OpenMetrics on given address
+        {
+            if (metrics_set)
+            {
+                throw std::invalid_argument("Metrics address already specified");
+            }
+            if (i < (argc - 1))
+            {
+                config.metrics_listen = argv[++i];
+                metrics_set = true;
+            }
+            else
+            {
+                throw std::invalid_argument("Missing address after --metrics-listen");
+            }
+        }
+        else if (arg == "--backend") // capture backend
+        {
+            if (backend_set)
+            {
+                throw std::invalid_argument("Capture backend already specified");
+            }
+            if (i < (argc - 1))
+            {
+                std::string backend = argv[++i];
+                if (backend == "pcap")
+                {
+                    config.capture.backend = CaptureBackend::PCAP;
+                }
+                else if (backend == "tpacket")
+                {
+                    config.capture.backend = CaptureBackend::TPACKET;
+                }
+                else
+                {
+                    throw std::invalid_argument("Capture backend must be pcap or tpacket.");
+                }
+                backend_set = true;
+            }
+            else
+            {
+                throw std::invalid_argument("Missing backend after --backend");
+            }
+        }
+        else if (arg == "--block-size") // TPACKET ring block size in KiB
+        {
+            if (block_size_set)
+            {
+                throw std::invalid_argument("Ring block size already specified");
+            }
+            if (i < (argc - 1))
+            {
+                config.capture.block_size = parseCount(argv[++i], 1024 * 1024, "Ring block size must be positive integer (KiB).") * 1024;
+                block_size_set = true;
+            }
+            else
+            {
+                throw std::invalid_argument("Missing size after --block-size");
+            }
+        }
+        else if (arg == "--block-count") // number of TPACKET ring blocks
+        {
+            if (block_count_set)
+            {
+                throw std::invalid_argument("Number of ring blocks already specified");
+            }
+            if (i < (argc - 1))
+            {
+                config.capture.block_count = parseCount(argv[++i], UINT16_MAX, "Number of ring blocks must be positive integer.");
+                block_count_set = true;
+            }
+            else
+            {
+                throw std::invalid_argument("Missing count after --block-count");
+            }
+        }
+        else if (arg == "--snaplen") // captured part of the packet
+        {
+            if (snaplen_set)
+            {
+                throw std::invalid_argument("Snaplen already specified");
+            }
+            if (i < (argc - 1))
+            {
+                config.capture.snaplen = parseCount(argv[++i], MAX_SNAPLEN, "Snaplen must be integer in range 1-262144.");
+                snaplen_set = true;
+            }
+            else
+            {
+                throw std::invalid_argument("Missing size after --snaplen");
+            }
+        }
+        else if (arg == "--buffer-size") // kernel capture buffer size in KiB
+        {
+            if (buffer_size_set)
+            {
+                throw std::invalid_argument("Buffer size already specified");
+            }
+            if (i < (argc - 1))
+            {
+                config.capture.buffer_size = parseCount(argv[++i], INT32_MAX / 1024, "Buffer size must be positive integer (KiB).") * 1024;
+                buffer_size_set = true;
+            }
+            else
+            {
+                throw std::invalid_argument("Missing size after --buffer-size");
+            }
+        }
+        else if (arg == "--immediate") // deliver packets without buffering
+        {
+            config.capture.immediate = true;
+        }
+        else if (arg == "--timeout") // packet buffer timeout in ms
+        {
+            if (timeout_set)
+            {
+                throw std::invalid_argument("Capture timeout already specified");
+            }
+            if (i < (argc - 1))
+            {
+                config.capture.timeout = parseCount(argv[++i], 60000, "Capture timeout must be integer in range 1-60000 (ms).");
+                timeout_set = true;
+            }
+            else
+            {
+                throw std::invalid_argument("Missing time after --timeout");
             }
         }
         else {
@@ -120,9 +537,41 @@ Config parseArgs(int argc, char *argv[])
         }
     }
 
-    if (!iface_set)
+    if (iface_set == file_set)
+    {
+        throw std::invalid_argument("Exactly one of interface or capture file must be specified");
+    }
+    if (file_set && (threads_set || backend_set))
+    {
+        throw std::invalid_argument("Capture file is replayed by one thread with libpcap, -j and --backend cannot be used with -r");
+    }
+    if (config.capture.paced && !file_set)
+    {
+        throw std::invalid_argument("--pace requires capture file");
+    }
+    if (idle_timeout_set && !config.cumulative)
+    {
+        throw std::invalid_argument("--idle-timeout requires --cumulative");
+    }
+    if (output_set && !format_set)
+    {
+        throw std::invalid_argument("-o requires --format");
+    }
+    if ((rotate_size_set || rotate_interval_set || fsync_set) && !output_set)
+    {
+        throw std::invalid_argument("--rotate-size, --rotate-interval and --fsync require -o");
+    }
+    if (config.cumulative && file_set && !config.capture.paced && !format_set)
+    {
+        throw std::invalid_argument("--cumulative requires periods, -r without --pace only measures throughput");
+    }
+    if (metrics_set && file_set && !config.capture.paced && !format_set)
+    {
+        throw std::invalid_argument("--metrics-listen requires periods, -r without --pace only measures throughput");
+    }
+    if (out_set && format_set)
     {
-        throw std::invalid_argument("Missing interface");
+        throw std::invalid_argument("-d saves the screen and cannot be used with --format");
     }
     return config;
 }
@@ -130,8 +579,31 @@ Config parseArgs(int argc, char *argv[])
 void help()
 {
     std::cout << "Usage:" << std::endl;
-    std::cout << "isa-top -i int [-s b|p]" << std::endl;
+    std::cout << "isa-top -i int|-r file [-s b|p]" << std::endl;
     std::cout << "  * -i int:  interface to be listened" << std::endl;
+    std::cout << "  * -r file: replay capture file as fast as possible and print throughput" << std::endl;
+    std::cout << "  * --pace: with -r, display the file in periods given by packet timestamps at capture speed" << std::endl;
+    std::cout << "  * -f filter: pcap filter expression evaluated in the kernel (default \"ip or ip6\")" << std::endl;
     std::cout << "  * -s b|p:  output is sorted by bits/packets/s" << std::endl;
     std::cout << "  * -t time: period after which the bandwidths are calculated" << std::endl;
+    std::cout << "  * -n count: number of displayed flows (default 10)" << std::endl;
+    std::cout << "  * -j threads: number of capture threads with packet fanout (default 1)" << std::endl;
+    std::cout << "  * --max-flows count: maximal number of flows tracked per period, or kept with --cumulative (default 65536)" << std::endl;
+    std::cout << "  * --cumulative: keep flows across periods and display 2s/10s/40s averages, peak and totals" << std::endl;
+    std::cout << "  * --idle-timeout s: with --cumulative, forget flows not seen for s seconds (default 60)" << std::endl;
+    std::cout << "  * --sketch counters: track top flows per period in fixed memory with Space-Saving and Count-Min" << std::endl;
+    std::cout << "  * --format jsonl|csv: write top flows of each period with exact counters instead of the screen" << std::endl;
+    std::cout << "  * -o file: with --format, append the records to file instead of stdout" << std::endl;
+    std::cout << "  * --rotate-size MiB: with -o, rename the file to file.YYYYmmdd-HHMMSS before it grows beyond MiB" << std::endl;
+    std::cout << "  * --rotate-interval s: with -o, rename the file to file.YYYYmmdd-HHMMSS every s seconds" << std::endl;
+    std::cout << "  * --fsync periods: with -o, flush the file to the disk once per given number of periods" << std::endl;
+    std::cout << "  * --metrics-listen addr:port: serve top flows and capture counters as OpenMetrics on http://addr:port/metrics" << std::endl;
+    std::cout << "  * --stats: show packets per protocol, flow table inserts and handler latency of every period (key i)" << std::endl;
+    std::cout << "  * --backend pcap|tpacket: capture with libpcap (default) or native TPACKET_V3 ring" << std::endl;
+    std::cout << "  * --block-size KiB: size of one TPACKET ring block (default 1024)" << std::endl;
+    std::cout << "  * --block-count count: number of TPACKET ring blocks (default 32)" << std::endl;
+    std::cout << "  * --snaplen octets: captured part of each packet (default 128)" << std::endl;
+    std::cout << "  * --buffer-size KiB: kernel capture buffer size (default libpcap default)" << std::endl;
+    std::cout << "  * --immediate: deliver packets to isa-top as soon as they arrive" << std::endl;
+    std::cout << "  * --timeout ms: packet buffer timeout (default 1000)" << std::endl;
 }
\ No newline at end of file
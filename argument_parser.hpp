@@ -10,16 +10,29 @@
 #ifndef ARG_HPP
 #define ARG_HPP
 #include <string>
-#include "flow_table.hpp"
+#include <cstddef>
+#include "flow_types.hpp"
+#include "capture_options.hpp"
+#include "flow_writer.hpp"
 
 struct Config
 {
-    const char* interface; // required
+    CaptureOptions capture; // interface required
     SortKey sort_key;
     bool help = false;
     bool out = false;
     std::string outDirector;
     int refresh_time;
+    size_t max_flows;
+    bool cumulative;  // keep flows across periods
+    int idle_timeout; // s, cumulative mode forgets flows idle for this long
+    size_t top_flows;
+    size_t sketch_counters; // flows monitored by the sketch, 0 for exact flow tables
+    OutputFormat format;    // records written instead of the ncurses view unless TERMINAL
+    const char *output;     // file the records are written to, nullptr for stdout
+    ExportOptions export_options; // rotation and fsync of the output file
+    const char *metrics_listen;   // address the OpenMetrics exporter listens on, nullptr if disabled
+    bool stats;                   // show pipeline counters and handler latency of every period
 };
 
 
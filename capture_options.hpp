@@ -0,0 +1,42 @@
+/**
+ * @file capture_options.hpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Options of the packet capture, set by the argument parser.
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#ifndef CAPTURE_OPTIONS_HPP
+#define CAPTURE_OPTIONS_HPP
+
+#include <cstddef>
+
+enum class CaptureBackend
+{
+    PCAP,   // libpcap
+    TPACKET // native AF_PACKET TPACKET_V3 ring
+};
+
+/**
+ * @brief Options of the packet capture.
+ * 
+ */
+struct CaptureOptions
+{
+    const char *interface;
+    const char *file;   // capture file replayed instead of the live interface
+    const char *filter; // pcap filter expression, nullptr for the default
+    bool paced;         // replay the file in periods given by packet timestamps
+    unsigned int threads;
+    CaptureBackend backend;
+    size_t block_size;  // TPACKET ring block size in octets
+    size_t block_count; // number of TPACKET ring blocks
+    int snaplen;        // captured part of the packet in octets
+    int buffer_size;    // kernel buffer size in octets, 0 for the libpcap default
+    bool immediate;     // deliver packets as soon as they arrive
+    int timeout;        // packet buffer timeout in ms
+    bool timed;         // measure handler latency of every packet
+};
+
+#endif
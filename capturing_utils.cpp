@@ -20,414 +20,562 @@
 #include <arpa/inet.h>
 #include <pcap.h>
 
-#include <memory>
-#include <stdexcept>
 #include <string.h>
 #include <iostream>
+#include <algorithm>
+#include <chrono>
 
 // Packet header sizes
 #define ETHER_SIZE 14        // octets
+#define SLL_SIZE 16          // octets, linux cooked capture
+#define SLL2_SIZE 20         // octets, linux cooked capture v2
+#define NULL_SIZE 4          // octets, BSD loopback address family
 #define IPV4_BASE_SIZE 20    // octets
 #define IPV6_HEADER_SIZE 40  // octets
-#define IPV6_EXT_HEADER_SIZE // octets
+#define PORTS_SIZE 4         // octets, tcp and udp source and destination port
 
 /**
- * @brief Capture structure
+ * @brief Check whether the protocol is one of the monitored protocols (tcp, udp, icmp, icmp6).
  * 
- * Holds captured data, current position in the captured data and total size of captured data.
+ * @param protocol_number 
+ * @return true if flows of the protocol are monitored
  */
-struct capture
+bool isMonitoredProtocol(uint8_t protocol_number)
 {
-    capture(const u_char *data_,
-            unsigned int pos_,
-            unsigned int caplen_) : data(data_), pos(pos_), caplen(caplen_) {}
-    const u_char * data;
-    unsigned int pos;
-    unsigned int caplen;
-};
+    switch (protocol_number)
+    {
+    case IPPROTO_TCP:
+    case IPPROTO_UDP:
+    case IPPROTO_ICMP:
+    case IPPROTO_ICMPV6:
+        return true;
+    default:
+        return false;
+    }
+}
 
 /**
- * @brief Get pointer to the capture data with offset pos
+ * @brief Check whether the protocol header starts with source and destination port.
  * 
- * @param cap capture structure
- * @return u_char* pointer to the captured data with offset pos
+ * @param protocol_number 
+ * @return true for tcp and udp
  */
-u_char *captureFromPos(struct capture cap)
+bool hasPorts(uint8_t protocol_number)
 {
-    return (u_char *)(cap.data + cap.pos);
+    return protocol_number == IPPROTO_TCP || protocol_number == IPPROTO_UDP;
 }
 
 /**
- * @brief Check whether there is enough data left in the capture for ethernet header.
+ * @brief Extract port numbers of the tcp or udp header.
  * 
- * @param cap capture structure
+ * @param transport start of the tcp or udp header, PORTS_SIZE octets must be captured
+ * @param key flow identification updated with the ports
  */
-void checkEther(struct capture cap)
+void readPortNumbers(const u_char *transport, FlowKey &key)
 {
-    if ((cap.pos + ETHER_SIZE) > cap.caplen)
-        throw std::runtime_error("Insufficient caplen to process ether frame.");
+    const udphdr *udp_tcp_header = (const udphdr *)transport;
+    key.src_port = ntohs(udp_tcp_header->source);
+    key.dst_port = ntohs(udp_tcp_header->dest);
 }
 
 /**
- * @brief Move to the ethernet payload in the capture.
+ * @brief Extract binary ipv4 source address from the captured data.
  * 
- * @param cap 
+ * @param ip_header 
+ * @return IpAddress 
  */
-void skipEther(struct capture *cap)
+IpAddress ipv4SourceAddress(const struct iphdr *ip_header)
 {
-    cap->pos += ETHER_SIZE;
+    IpAddress address = {};
+    address.words[0] = ip_header->saddr;
+    return address;
 }
 
-
 /**
- * @brief Check whether there is enough data left in the capture for ipv4 header without options.
+ * @brief Extract binary ipv4 destination address from the ipv4 header
  * 
- * @param cap 
+ * @param ip_header 
+ * @return IpAddress 
  */
-void checkIPv4BaseHeader(struct capture cap)
+IpAddress ipv4DestinationAddress(const struct iphdr *ip_header)
 {
-    if ((cap.pos + IPV4_BASE_SIZE) > cap.caplen)
-        throw std::runtime_error("Insufficient caplen to process ipv4 base header.");
+    IpAddress address = {};
+    address.words[0] = ip_header->daddr;
+    return address;
 }
 
-
 /**
- * @brief Check whether there is enough data left in the capture for ipv4 header including options.
+ * @brief Extract protocol number from the ipv4 header.
  * 
- * @param cap 
+ * @param ip_header 
+ * @return uint8_t 
  */
-void checkIPv4Header(struct capture cap, u_char ihl)
+uint8_t ipv4Protocol(const struct iphdr *ip_header)
 {
-    if ((cap.pos + ihl * 4) > cap.caplen)
-        throw std::runtime_error("Insufficient caplen to process ipv4 header.");
+    return ip_header->protocol;
 }
 
 /**
- * @brief Move to the ipv4 payload in the capture.
+ * @brief Extract total length name from the ipv4 packet;
  * 
- * @param cap 
- * @param ihl internet header length
+ * @param ip_header 
+ * @return std::string 
  */
-void skipIPv4Header(struct capture *cap, u_char ihl)
+uint16_t ipv4TotalLength(const struct iphdr *ip_header)
 {
-    cap->pos += ihl * 4;
+    return ntohs(ip_header->tot_len);
 }
 
+
 /**
- * @brief Check whether there is enough data left in the capture for ipv6 header.
+ * @brief Extract binary ipv6 source address from the ipv6 header
  * 
- * @param cap 
+ * @param ip_header 
+ * @return IpAddress 
  */
-void checkIPv6BaseHeader(struct capture cap)
+IpAddress ipv6SourceAddress(const struct ip6_hdr *ip6_header)
 {
-    if ((cap.pos + IPV6_HEADER_SIZE) > cap.caplen)
-        throw std::runtime_error("Insufficient caplen to process ipv6 base header.");
+    IpAddress address;
+    memcpy(address.bytes, &(ip6_header->ip6_src), sizeof(address.bytes));
+    return address;
 }
 
 /**
- * @brief Move to the ipv6 payload in the capture.
+ * @brief Extract binary ipv6 destination address from the ipv6 header
  * 
- * @param cap 
+ * @param ip_header 
+ * @return IpAddress 
  */
-void skipIPv6BaseHeader(struct capture *cap)
+IpAddress ipv6DestinationAddress(const struct ip6_hdr *ip6_header)
 {
-    cap->pos += IPV6_HEADER_SIZE;
+    IpAddress address;
+    memcpy(address.bytes, &(ip6_header->ip6_dst), sizeof(address.bytes));
+    return address;
 }
 
+
 /**
- * @brief Check whether there is enough data left in the capture for tcp/udp source and destination port numbers.
+ * @brief Extract protocol number from the ipv6 header.
  * 
- * @param cap 
+ * @param ip6_header 
+ * @return uint8_t 
  */
-void checkTcpUdpPorts(struct capture cap)
+uint8_t ipv6Protocol(const struct ip6_hdr *ip6_header)
 {
-    if ((cap.pos + 4) > cap.caplen)
-        throw std::runtime_error("Insufficient caplen to process tcp and udp port numbers.");
+    return ip6_header->ip6_ctlun.ip6_un1.ip6_un1_nxt;
 }
 
 /**
- * @brief Convert protocol number into the string representation.
+ * @brief Extract total length name from the ipv6 packet;
  * 
- * @param protocol_number 
+ * @param ip_header 
  * @return std::string 
  */
-std::string getProtocolNameByNumber(uint8_t protocol_number)
+uint16_t ipv6TotalLength(const struct ip6_hdr *ip6_header)
 {
-    switch (protocol_number)
-    {
-    case 6:
-        return "tcp";
-    case 17:
-        return "udp";
-    case 1:
-        return "icmp";
-    case 58:
-        return "icmp6";
-    default:
-        return "Unknown";
-    }
+    return ntohs(ip6_header->ip6_ctlun.ip6_un1.ip6_un1_plen) + 40;
 }
 
 /**
- * @brief Extract port numbers from the captured data.
+ * @brief Identify the flow of the ipv4 packet.
  * 
- * @param cap 
- * @return std::pair<uint16_t, uint16_t> 
+ * Length needed for the whole decoding is known once the protocol and the header length are read,
+ * so the captured length is checked only once per header.
+ * 
+ * @param data start of the ipv4 header
+ * @param caplen number of captured octets from data
+ * @param record output flow identification and length of the packet
+ * @return DecodeStatus 
  */
-std::pair<uint16_t, uint16_t> getPortNumbers(struct capture cap)
+DecodeStatus decodeIPv4(const u_char *data, unsigned int caplen, FlowRecord &record)
 {
-    checkTcpUdpPorts(cap);
-
-    const udphdr *udp_tcp_header = (const udphdr *)(captureFromPos(cap));
-    uint16_t src_port;
-    uint16_t dst_port;
-    // Save src, dst port
-    src_port = ntohs(udp_tcp_header->source);
-    dst_port = ntohs(udp_tcp_header->dest);
-    return std::pair<uint16_t, uint16_t>(src_port, dst_port);
+    if (caplen < IPV4_BASE_SIZE)
+        return DecodeStatus::TRUNCATED_NETWORK;
+
+    const iphdr *ip_header = (const iphdr *)data;
+    uint8_t protocol = ipv4Protocol(ip_header);
+    if (ip_header->ihl < 5)
+        return DecodeStatus::MALFORMED_HEADER;
+    if (!isMonitoredProtocol(protocol))
+        return DecodeStatus::UNSUPPORTED_TRANSPORT;
+
+    unsigned int header_size = ip_header->ihl * 4;
+    if (hasPorts(protocol) && caplen < header_size + PORTS_SIZE)
+        return DecodeStatus::TRUNCATED_TRANSPORT;
+
+    record.key = FlowKey(ipv4SourceAddress(ip_header), 0, ipv4DestinationAddress(ip_header), 0, protocol, IpAddrClass::IPV4);
+    record.bytes = ipv4TotalLength(ip_header);
+    if (hasPorts(protocol))
+        readPortNumbers(data + header_size, record.key);
+    return DecodeStatus::VALID;
 }
 
-
 /**
- * @brief Extract string representation of ipv4 source address from the captured data.
+ * @brief Identify the flow of the ipv6 packet.
  * 
- * @param ip_header 
- * @return std::string 
+ * @param data start of the ipv6 header
+ * @param caplen number of captured octets from data
+ * @param record output flow identification and length of the packet
+ * @return DecodeStatus 
  */
-std::string ipv4SourceAddress(const struct iphdr *ip_header)
+DecodeStatus decodeIPv6(const u_char *data, unsigned int caplen, FlowRecord &record)
 {
-    char *address;
-    struct in_addr ipv4_address;
-    char ip4_source[INET_ADDRSTRLEN];
-
-    ipv4_address.s_addr = ip_header->saddr;
-    address = inet_ntoa(ipv4_address);
-    memcpy(ip4_source, address, 15);
-    ip4_source[15] = 0;
-    return std::string(ip4_source);
+    if (caplen < IPV6_HEADER_SIZE)
+        return DecodeStatus::TRUNCATED_NETWORK;
+
+    const ip6_hdr *ip6_header = (const ip6_hdr *)data;
+    uint8_t protocol = ipv6Protocol(ip6_header); // TODO: extension headers
+    if (!isMonitoredProtocol(protocol))
+        return DecodeStatus::UNSUPPORTED_TRANSPORT;
+    if (hasPorts(protocol) && caplen < IPV6_HEADER_SIZE + PORTS_SIZE)
+        return DecodeStatus::TRUNCATED_TRANSPORT;
+
+    record.key = FlowKey(ipv6SourceAddress(ip6_header), 0, ipv6DestinationAddress(ip6_header), 0, protocol, IpAddrClass::IPV6);
+    record.bytes = ipv6TotalLength(ip6_header);
+    if (hasPorts(protocol))
+        readPortNumbers(data + IPV6_HEADER_SIZE, record.key);
+    return DecodeStatus::VALID;
 }
 
 /**
- * @brief Extract string representation of ipv4 destination address from the ipv4 header
+ * @brief Identify the flow of the network layer packet given by its ethertype.
  * 
- * @param ip_header 
- * @return std::string 
+ * @param ether_type ethertype in host byte order
+ * @param data start of the network header
+ * @param caplen number of captured octets from data
+ * @param record output flow identification and length of the packet
+ * @return DecodeStatus 
  */
-std::string ipv4DestinationAddress(const struct iphdr *ip_header)
+static inline DecodeStatus decodeEtherType(uint16_t ether_type, const u_char *data, unsigned int caplen, FlowRecord &record)
 {
-    char *address;
-    struct in_addr ipv4_address;
-    char ip4_destination[INET_ADDRSTRLEN];
-
-    ipv4_address.s_addr = ip_header->daddr;
-    address = inet_ntoa(ipv4_address);
-    memcpy(ip4_destination, address, 15);
-    ip4_destination[15] = 0;
-    return std::string(ip4_destination);
+    switch (ether_type)
+    {
+    case ETHERTYPE_IP:
+        return decodeIPv4(data, caplen, record);
+    case ETHERTYPE_IPV6:
+        return decodeIPv6(data, caplen, record);
+    default:
+        return DecodeStatus::UNSUPPORTED_NETWORK;
+    }
 }
 
-
 /**
- * @brief Extract protocol name from the ipv4 header.
+ * @brief Identify the flow the captured ethernet frame belongs to (DLT_EN10MB).
  * 
- * @param ip_header 
- * @return std::string 
+ * Decoders never throw, packets which cannot be accounted are reported by the status.
+ * 
+ * @param packet_header 
+ * @param packet 
+ * @param record output flow identification and length of the packet, valid only if VALID is returned
+ * @return DecodeStatus 
  */
-std::string ipv4Protocol(const struct iphdr *ip_header)
+DecodeStatus decodeEthernet(const struct pcap_pkthdr *packet_header, const u_char *packet, FlowRecord &record)
 {
-    return getProtocolNameByNumber(ip_header->protocol);
+    unsigned int caplen = packet_header->caplen;
+    if (caplen < ETHER_SIZE)
+        return DecodeStatus::TRUNCATED_LINK;
+
+    const struct ether_header *eth_header = (const struct ether_header *)packet;
+    return decodeEtherType(ntohs(eth_header->ether_type), packet + ETHER_SIZE, caplen - ETHER_SIZE, record);
 }
 
 /**
- * @brief Extract total length name from the ipv4 packet;
+ * @brief Identify the flow of the linux cooked capture frame (DLT_LINUX_SLL), e.g. captured on "any".
  * 
- * @param ip_header 
- * @return std::string 
+ * @param packet_header 
+ * @param packet 
+ * @param record 
+ * @return DecodeStatus 
  */
-uint16_t ipv4TotalLength(const struct iphdr *ip_header)
+DecodeStatus decodeLinuxSll(const struct pcap_pkthdr *packet_header, const u_char *packet, FlowRecord &record)
 {
-    return ntohs(ip_header->tot_len);
-}
+    unsigned int caplen = packet_header->caplen;
+    if (caplen < SLL_SIZE)
+        return DecodeStatus::TRUNCATED_LINK;
 
+    uint16_t protocol = (packet[14] << 8) | packet[15]; // last field of the header
+    return decodeEtherType(protocol, packet + SLL_SIZE, caplen - SLL_SIZE, record);
+}
 
 /**
- * @brief Extract string representation of ipv6 source address from the ipv6 header
+ * @brief Identify the flow of the linux cooked capture v2 frame (DLT_LINUX_SLL2).
  * 
- * @param ip_header 
- * @return std::string 
+ * @param packet_header 
+ * @param packet 
+ * @param record 
+ * @return DecodeStatus 
  */
-std::string ipv6SourceAddress(const struct ip6_hdr *ip6_header)
+DecodeStatus decodeLinuxSll2(const struct pcap_pkthdr *packet_header, const u_char *packet, FlowRecord &record)
 {
-    char ip6_address[INET6_ADDRSTRLEN];
-    if (inet_ntop(AF_INET6, &(ip6_header->ip6_src), ip6_address, INET6_ADDRSTRLEN) == NULL){
-        throw std::runtime_error("Insufficient caplen to process tcp and udp port numbers.");
-    };
-    return std::string(ip6_address);
+    unsigned int caplen = packet_header->caplen;
+    if (caplen < SLL2_SIZE)
+        return DecodeStatus::TRUNCATED_LINK;
+
+    uint16_t protocol = (packet[0] << 8) | packet[1]; // first field of the header
+    return decodeEtherType(protocol, packet + SLL2_SIZE, caplen - SLL2_SIZE, record);
 }
 
 /**
- * @brief Extract string representation of ipv6 destination address from the ipv6 header
+ * @brief Identify the flow of the packet without link layer header (DLT_RAW, DLT_IPV4, DLT_IPV6), e.g. tun or wireguard.
  * 
- * @param ip_header 
- * @return std::string 
+ * Network protocol is given by the ip version.
+ * 
+ * @param packet_header 
+ * @param packet 
+ * @param record 
+ * @return DecodeStatus 
  */
-std::string ipv6DestinationAddress(const struct ip6_hdr *ip6_header)
+DecodeStatus decodeRaw(const struct pcap_pkthdr *packet_header, const u_char *packet, FlowRecord &record)
 {
-    char ip6_address[INET6_ADDRSTRLEN];
+    unsigned int caplen = packet_header->caplen;
+    if (caplen < 1)
+        return DecodeStatus::TRUNCATED_NETWORK;
 
-    if (inet_ntop(AF_INET6, &(ip6_header->ip6_dst), ip6_address, INET6_ADDRSTRLEN) == NULL){
-        throw std::runtime_error("Insufficient caplen to process tcp and udp port numbers.");
-    };
-    return std::string(ip6_address);
+    switch (packet[0] >> 4)
+    {
+    case 4:
+        return decodeIPv4(packet, caplen, record);
+    case 6:
+        return decodeIPv6(packet, caplen, record);
+    default:
+        return DecodeStatus::UNSUPPORTED_NETWORK;
+    }
 }
 
-
 /**
- * @brief Extract protocol name from the ipv6 header.
+ * @brief Identify the flow of the BSD loopback frame (DLT_NULL, DLT_LOOP).
  * 
- * @param ip6_header 
- * @return std::string 
+ * Header holds the address family in the byte order of the capturing host (DLT_NULL)
+ * or in network byte order (DLT_LOOP), families fit into 16 bits, so byte order is detected.
+ * Value of AF_INET6 differs between systems.
+ * 
+ * @param packet_header 
+ * @param packet 
+ * @param record 
+ * @return DecodeStatus 
  */
-std::string ipv6Protocol(const struct ip6_hdr *ip6_header)
+DecodeStatus decodeNull(const struct pcap_pkthdr *packet_header, const u_char *packet, FlowRecord &record)
 {
-    return getProtocolNameByNumber(ip6_header->ip6_ctlun.ip6_un1.ip6_un1_nxt);
+    unsigned int caplen = packet_header->caplen;
+    if (caplen < NULL_SIZE)
+        return DecodeStatus::TRUNCATED_LINK;
+
+    uint32_t family;
+    memcpy(&family, packet, sizeof(family));
+    if (family > 0xffff)
+        family = __builtin_bswap32(family);
+
+    switch (family)
+    {
+    case 2: // AF_INET
+        return decodeIPv4(packet + NULL_SIZE, caplen - NULL_SIZE, record);
+    case 10: // AF_INET6 - Linux
+    case 24: // AF_INET6 - NetBSD, OpenBSD
+    case 28: // AF_INET6 - FreeBSD
+    case 30: // AF_INET6 - macOS
+        return decodeIPv6(packet + NULL_SIZE, caplen - NULL_SIZE, record);
+    default:
+        return DecodeStatus::UNSUPPORTED_NETWORK;
+    }
 }
 
 /**
- * @brief Extract total length name from the ipv6 packet;
+ * @brief Decoder of the link type returned by pcap_datalink.
  * 
- * @param ip_header 
- * @return std::string 
+ * @param link_type DLT_ value
+ * @return PacketDecoder decoder or nullptr if the link type is not supported
  */
-uint16_t ipv6TotalLength(const struct ip6_hdr *ip6_header)
+PacketDecoder decoderForLinkType(int link_type)
 {
-    return ntohs(ip6_header->ip6_ctlun.ip6_un1.ip6_un1_plen) + 40;
+    switch (link_type)
+    {
+    case DLT_EN10MB:
+        return decodeEthernet;
+    case DLT_LINUX_SLL:
+        return decodeLinuxSll;
+#ifdef DLT_LINUX_SLL2
+    case DLT_LINUX_SLL2:
+        return decodeLinuxSll2;
+#endif
+    case DLT_RAW:
+#ifdef DLT_IPV4
+    case DLT_IPV4:
+    case DLT_IPV6:
+#endif
+        return decodeRaw;
+    case DLT_NULL:
+    case DLT_LOOP:
+        return decodeNull;
+    default:
+        return nullptr;
+    }
 }
 
 /**
- * @brief Create pair of flow identification and length of data. ((IPsrc:port, IPdst:port), length)
+ * @brief Human readable reason of the skipped packet.
  * 
- * @param cap 
- * @return std::pair<FlowKey, uint16_t> 
+ * @param status 
+ * @return const char* 
  */
-std::pair<FlowKey, uint16_t> processIPv4(struct capture cap)
+const char *decodeStatusName(DecodeStatus status)
 {
-    checkIPv4BaseHeader(cap);
-
-    const iphdr *ip_header = (const iphdr *)(captureFromPos(cap));
-    std::string source_address = ipv4SourceAddress(ip_header);
-    std::string destination_address = ipv4DestinationAddress(ip_header);
-    std::string protocol = ipv4Protocol(ip_header);
-    uint16_t length = ipv4TotalLength(ip_header);
-    std::tuple<uint16_t, uint16_t> src_dst_port = {0, 0}; // by default 0 - unused
+    switch (status)
+    {
+    case DecodeStatus::VALID:
+        return "valid";
+    case DecodeStatus::TRUNCATED_LINK:
+        return "truncated link header";
+    case DecodeStatus::TRUNCATED_NETWORK:
+        return "truncated ip header";
+    case DecodeStatus::TRUNCATED_TRANSPORT:
+        return "truncated tcp/udp ports";
+    case DecodeStatus::MALFORMED_HEADER:
+        return "malformed ip header";
+    case DecodeStatus::UNSUPPORTED_NETWORK:
+        return "not ip";
+    case DecodeStatus::UNSUPPORTED_TRANSPORT:
+        return "not tcp/udp/icmp";
+    default:
+        return "unknown";
+    }
+}
 
-    // TCP, UDP
-    if ((ip_header->protocol == IPPROTO_TCP) || (ip_header->protocol == IPPROTO_UDP))
+/**
+ * @brief Name of the transport protocol, as displayed in the protocol column.
+ * 
+ * @param protocol 
+ * @return const char* 
+ */
+const char *transportProtocolName(TransportProtocol protocol)
+{
+    switch (protocol)
     {
-        checkIPv4Header(cap, ip_header->ihl);
-        skipIPv4Header(&cap, ip_header->ihl);
-        src_dst_port = getPortNumbers(cap);
+    case TransportProtocol::TCP:
+        return "tcp";
+    case TransportProtocol::UDP:
+        return "udp";
+    case TransportProtocol::ICMP:
+        return "icmp";
+    case TransportProtocol::ICMPV6:
+        return "icmp6";
+    default:
+        return "unknown";
     }
+}
 
-    return {FlowKey(source_address, std::get<0>(src_dst_port), destination_address, std::get<1>(src_dst_port), protocol, IpAddrClass::IPV4), length};
+/**
+ * @brief Nanoseconds from begin to end, 0 if the clock did not advance.
+ * 
+ * @param begin 
+ * @param end 
+ * @return unsigned long long 
+ */
+static unsigned long long nanosecondsBetween(std::chrono::steady_clock::time_point begin, std::chrono::steady_clock::time_point end)
+{
+    long long elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+    return elapsed > 0 ? elapsed : 0;
+}
+
+/**
+ * @brief Bucket of the handler latency histogram.
+ * 
+ * Values below 2^LATENCY_SUB_BUCKET_BITS have a bucket each, larger ones are grouped by their
+ * highest set bit and split by the following LATENCY_SUB_BUCKET_BITS bits.
+ * 
+ * @param ns 
+ * @return size_t 
+ */
+size_t latencyBucket(unsigned long long ns)
+{
+    const unsigned long long sub_buckets = 1ULL << LATENCY_SUB_BUCKET_BITS;
+    if (ns < sub_buckets)
+        return ns;
+
+    int highest_bit = 63 - __builtin_clzll(ns);
+    int shift = highest_bit - LATENCY_SUB_BUCKET_BITS;
+    size_t bucket = (size_t)(shift + 1) * sub_buckets + ((ns >> shift) & (sub_buckets - 1));
+    return std::min(bucket, (size_t)LATENCY_BUCKETS - 1);
 }
 
 /**
- * @brief Create pair of flow identification and length of data. ((IPsrc:port, IPdst:port), length)
+ * @brief Largest latency counted in the bucket.
  * 
- * @param cap 
- * @return std::pair<FlowKey, uint16_t> 
+ * @param bucket 
+ * @return unsigned long long ns
  */
-std::pair<FlowKey, uint16_t> processIPv6(struct capture cap)
+unsigned long long latencyBucketLimit(size_t bucket)
 {
-    checkIPv6BaseHeader(cap);
+    const unsigned long long sub_buckets = 1ULL << LATENCY_SUB_BUCKET_BITS;
+    if (bucket < sub_buckets)
+        return bucket;
 
-    const ip6_hdr *ip6_header = (const ip6_hdr *)(captureFromPos(cap));
-    std::string source_address = ipv6SourceAddress(ip6_header);
-    std::string destination_address = ipv6DestinationAddress(ip6_header);
-    std::string protocol = ipv6Protocol(ip6_header); // TODO: extension headers
-    uint16_t length = ipv6TotalLength(ip6_header);
-    std::tuple<uint16_t, uint16_t> src_dst_port = {0, 0}; // by default 0 - unused
+    int shift = bucket / sub_buckets - 1;
+    unsigned long long lowest = (sub_buckets + bucket % sub_buckets) << shift;
+    return lowest + (1ULL << shift) - 1;
+}
 
-    uint8_t protocol_number = ip6_header->ip6_ctlun.ip6_un1.ip6_un1_nxt;
-    if ((protocol_number == IPPROTO_TCP) || (protocol_number == IPPROTO_UDP))
+/**
+ * @brief Apply the batched records to the flow table, count them by the transport protocol
+ * and count the handler latency of each of them.
+ * 
+ * @param context 
+ */
+void flushCaptureBatch(CaptureContext *context)
+{
+    if (context->batched == 0)
+        return;
+    if (context->counters != nullptr)
+        context->counters->countBatch(context->batch, context->batched);
+    context->table->addOrUpdateBatch(context->batch, context->batched);
+    if (context->timed)
     {
-        skipIPv6BaseHeader(&cap);
-        src_dst_port = getPortNumbers(cap);
+        std::chrono::steady_clock::time_point applied = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < context->batched; i++)
+            context->counters->countLatency(nanosecondsBetween(context->handler_start[i], applied));
     }
-
-    return {FlowKey(source_address, std::get<0>(src_dst_port), destination_address, std::get<1>(src_dst_port), protocol, IpAddrClass::IPV6), length};
+    context->batched = 0;
 }
 
 /**
  * @brief Processes the captured packet.
  * 
- * Identifies flow the packet belongs to and update the flow table accordingly.
+ * Identifies flow the packet belongs to and queues it in the batch of the context,
+ * the flow table is updated once the batch is full. Packets which cannot be accounted
+ * are counted by the reason.
  * 
- * @param args 
+ * @param args CaptureContext
  * @param packet_header 
  * @param packet 
  */
 void packet_handler(u_char *args, const struct pcap_pkthdr *packet_header, const u_char *packet)
 {
-    if (args == nullptr)
+    CaptureContext *context = (CaptureContext *)args;
+    if (context == nullptr || context->table == nullptr)
     {
-        std::cerr << "Error: args passed to the packet_handler is NULL" << std::endl;
+        std::cerr << "Error: invalid capture context passed to the packet_handler" << std::endl;
         exit(1);
     }
-    void **args_ = (void **)args;
-    if (args_[0] == nullptr || args_[1] == nullptr)
-    {
-        std::cerr << "Error: invalid content of args" << std::endl;
-        exit(1);
-    }
-    void *arg1 = args_[0];
-    void *arg2 = args_[1];
-    FlowTable *table = (FlowTable *) arg1;
-    pcap_t* handle = (pcap_t*) arg2;
-    if (table == nullptr || handle == nullptr)
-    {
-        std::cerr << "Error: either of passed arguments is null" << std::endl;
-        exit(1);
-    }
-
-    std::pair<FlowKey, uint16_t> capture({FlowKey("", 0, "", 0, "", IpAddrClass::IPV4), 0});
-
-    struct capture cap(packet, 0, packet_header->caplen);
 
-    try {
-        checkEther(cap);
-        struct ether_header *eth_header;
-        eth_header = (struct ether_header *)captureFromPos(cap);
+    std::chrono::steady_clock::time_point start;
+    if (context->timed)
+        start = std::chrono::steady_clock::now();
 
-        switch (ntohs(eth_header->ether_type))
+    FlowRecord &record = context->batch[context->batched];
+    DecodeStatus status = context->decode(packet_header, packet, record);
+    if (status != DecodeStatus::VALID)
+    {
+        if (context->counters != nullptr)
         {
-        case ETHERTYPE_IP:
-            skipEther(&cap);
-            capture = processIPv4(cap);
-            break;
-        case ETHERTYPE_IPV6:
-            skipEther(&cap);
-            capture = processIPv6(cap);
-            break;
-        default:
-            return;
+            context->counters->count(status);
+            if (context->timed)
+                context->counters->countLatency(nanosecondsBetween(start, std::chrono::steady_clock::now()));
         }
-    } catch (const std::runtime_error &err)
-    {
-        // Skip packets which cannot be analyzed
-        return;
-    }
-    catch (const std::exception &ex)
-    {
-        // Any other error causes program termination.
-        pcap_breakloop(handle);
         return;
     }
 
-    if (capture.first.protocol == "Unknown")
-        return;
-
     // Update the table
-    table->addOrUpdateRecord(capture.first, capture.second);
-}
\ No newline at end of file
+    if (context->timed)
+        context->handler_start[context->batched] = start;
+    if (++context->batched == FLOW_BATCH_SIZE)
+        flushCaptureBatch(context);
+}
@@ -11,7 +11,276 @@
 #define CAPTURING_UTILS_HPP
 
 #include <pcap.h>
+#include <netinet/in.h>
+#include <utility>
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include "flow_table.hpp"
 
+/**
+ * @brief Result of the packet decoding, reason why the packet is not accounted if not VALID.
+ * 
+ */
+enum class DecodeStatus : uint8_t
+{
+    VALID = 0,
+    TRUNCATED_LINK,       // caplen shorter than the link layer header
+    TRUNCATED_NETWORK,    // caplen shorter than the ip header
+    TRUNCATED_TRANSPORT,  // caplen shorter than the tcp/udp ports
+    MALFORMED_HEADER,     // invalid header field
+    UNSUPPORTED_NETWORK,  // not ipv4 or ipv6
+    UNSUPPORTED_TRANSPORT // not tcp, udp, icmp or icmp6
+};
+
+#define DECODE_STATUS_COUNT 7
+
+/**
+ * @brief Transport protocol of the accounted packet, index of the per-protocol counters.
+ * 
+ */
+enum class TransportProtocol : uint8_t
+{
+    TCP = 0,
+    UDP,
+    ICMP,
+    ICMPV6
+};
+
+#define TRANSPORT_PROTOCOL_COUNT 4
+
+#define CACHE_LINE_SIZE 64
+
+// Handler latency histogram with HDR-style buckets, every power of two of ns is split into
+// 2^LATENCY_SUB_BUCKET_BITS linear buckets, so a value is known within 25 %.
+#define LATENCY_SUB_BUCKET_BITS 2
+#define LATENCY_BUCKETS 160 // up to 2^40 ns, longer handler times are counted in the last bucket
+
+size_t latencyBucket(unsigned long long ns);
+unsigned long long latencyBucketLimit(size_t bucket);
+
+/**
+ * @brief Transport protocol of the IANA protocol number, decoded packets are never of other protocols.
+ * 
+ * @param protocol IANA protocol number
+ * @return TransportProtocol 
+ */
+inline TransportProtocol transportProtocol(uint8_t protocol)
+{
+    switch (protocol)
+    {
+    case IPPROTO_TCP:
+        return TransportProtocol::TCP;
+    case IPPROTO_UDP:
+        return TransportProtocol::UDP;
+    case IPPROTO_ICMP:
+        return TransportProtocol::ICMP;
+    default:
+        return TransportProtocol::ICMPV6;
+    }
+}
+
+/**
+ * @brief Number of skipped packets per reason, accounted packets and octets per transport protocol
+ * and handler latency, updated by one capture thread and read by any thread.
+ * 
+ * Each capture thread has its own counters, padded so that they never share a cache line
+ * with data used by other threads. Readers sum them at the end of the period.
+ */
+struct DecodeCounters
+{
+    DecodeCounters()
+    {
+        for (std::atomic<unsigned long long> &counter : skipped)
+            counter.store(0, std::memory_order_relaxed);
+        for (size_t i = 0; i < TRANSPORT_PROTOCOL_COUNT; i++)
+        {
+            packets[i].store(0, std::memory_order_relaxed);
+            bytes[i].store(0, std::memory_order_relaxed);
+        }
+        for (std::atomic<unsigned long long> &counter : latency)
+            counter.store(0, std::memory_order_relaxed);
+    }
+
+    // Single writer, increment does not need atomic read-modify-write
+    void count(DecodeStatus status)
+    {
+        std::atomic<unsigned long long> &counter = skipped[(size_t)status];
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    // Batch is summed first, so each counter is stored at most once per batch
+    void countBatch(const FlowRecord *records, size_t count)
+    {
+        unsigned long long batch_packets[TRANSPORT_PROTOCOL_COUNT] = {};
+        unsigned long long batch_bytes[TRANSPORT_PROTOCOL_COUNT] = {};
+        for (size_t i = 0; i < count; i++)
+        {
+            size_t protocol = (size_t)transportProtocol(records[i].key.protocol);
+            batch_packets[protocol]++;
+            batch_bytes[protocol] += records[i].bytes;
+        }
+        for (size_t i = 0; i < TRANSPORT_PROTOCOL_COUNT; i++)
+        {
+            if (batch_packets[i] == 0)
+                continue;
+            packets[i].store(packets[i].load(std::memory_order_relaxed) + batch_packets[i], std::memory_order_relaxed);
+            bytes[i].store(bytes[i].load(std::memory_order_relaxed) + batch_bytes[i], std::memory_order_relaxed);
+        }
+    }
+
+    // Count handled packet which took ns
+    void countLatency(unsigned long long ns)
+    {
+        std::atomic<unsigned long long> &counter = latency[latencyBucket(ns)];
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    char leading_padding[CACHE_LINE_SIZE];
+    std::atomic<unsigned long long> skipped[DECODE_STATUS_COUNT];
+    std::atomic<unsigned long long> packets[TRANSPORT_PROTOCOL_COUNT]; // accounted packets by TransportProtocol
+    std::atomic<unsigned long long> bytes[TRANSPORT_PROTOCOL_COUNT];   // accounted octets by TransportProtocol
+    std::atomic<unsigned long long> latency[LATENCY_BUCKETS];          // handled packets by latencyBucket
+    char trailing_padding[CACHE_LINE_SIZE];
+};
+
+/**
+ * @brief Decoder of the frames of one link type, fills the record if VALID is returned.
+ * 
+ */
+typedef DecodeStatus (*PacketDecoder)(const struct pcap_pkthdr *, const u_char *, FlowRecord &);
+
+/**
+ * @brief Arguments of the packet_handler.
+ * 
+ * Packets are parsed into the batch, which is applied to the table when it is full
+ * and by flushCaptureBatch after every buffer or block returned by the capture backend.
+ * Decoder of the link type is selected once, when the capture is opened.
+ * 
+ * Handler latency of each packet is measured from the start of its handler until its record
+ * is applied to the table, or until the handler returns if the packet is skipped. The clock
+ * is read once per packet and once per applied batch, so packets are timed only on request.
+ * 
+ */
+struct CaptureContext
+{
+    CaptureContext(FlowTable *table_, PacketDecoder decode_, DecodeCounters *counters_, bool timed_)
+        : table(table_), decode(decode_), counters(counters_), timed(timed_ && counters_ != nullptr), batched(0) {}
+    FlowTable *table;
+    PacketDecoder decode;
+    DecodeCounters *counters; // may be nullptr if packets are not counted
+    bool timed;               // handler latency of every packet is counted, requires counters
+    FlowRecord batch[FLOW_BATCH_SIZE];
+    size_t batched; // number of records in the batch
+    std::chrono::steady_clock::time_point handler_start[FLOW_BATCH_SIZE]; // of the batched records, only if timed
+};
+
+/**
+ * @brief Capture and pipeline counters since the start of the capture.
+ * 
+ */
+struct CaptureStats
+{
+    CaptureStats() : received(0), dropped(0), interface_dropped(0), skipped(), packets(), bytes(),
+                     inserted(0), rejected(0), retire_wait_ns(0), latency() {}
+    unsigned long long received;          // packets received by the capture socket
+    unsigned long long dropped;           // packets dropped because the buffer or ring was full
+    unsigned long long interface_dropped; // packets dropped by the interface or its driver
+    unsigned long long skipped[DECODE_STATUS_COUNT]; // packets not accounted by the reason (DecodeStatus)
+    unsigned long long packets[TRANSPORT_PROTOCOL_COUNT]; // accounted packets by TransportProtocol
+    unsigned long long bytes[TRANSPORT_PROTOCOL_COUNT];   // accounted octets by TransportProtocol
+    unsigned long long inserted;          // flows inserted into the exact flow tables
+    unsigned long long rejected;          // packets of flows not inserted because the table was full
+    unsigned long long retire_wait_ns;    // time the period boundaries waited for the tables
+    unsigned long long latency[LATENCY_BUCKETS]; // handled packets by latencyBucket
+
+    /**
+     * @brief Number of accounted packets of all protocols.
+     * 
+     * @return unsigned long long 
+     */
+    unsigned long long packetsTotal() const
+    {
+        unsigned long long total = 0;
+        for (unsigned long long count : packets)
+            total += count;
+        return total;
+    }
+
+    /**
+     * @brief Handler latency in ns not exceeded by the given fraction of the handled packets.
+     * 
+     * @param fraction 0 - 1
+     * @return unsigned long long upper limit of the bucket, 0 if no packet was handled
+     */
+    unsigned long long latencyPercentile(double fraction) const
+    {
+        unsigned long long total = 0;
+        for (unsigned long long count : latency)
+            total += count;
+        if (total == 0)
+            return 0;
+
+        unsigned long long seen = 0;
+        for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+        {
+            seen += latency[i];
+            if (seen > 0 && seen >= fraction * total)
+                return latencyBucketLimit(i);
+        }
+        return latencyBucketLimit(LATENCY_BUCKETS - 1);
+    }
+
+    /**
+     * @brief Number of skipped packets for all reasons.
+     * 
+     * @return unsigned long long 
+     */
+    unsigned long long skippedTotal() const
+    {
+        unsigned long long total = 0;
+        for (unsigned long long count : skipped)
+            total += count;
+        return total;
+    }
+
+    /**
+     * @brief Counters accumulated since the previous reading.
+     * 
+     * @param previous earlier reading of the counters
+     * @return CaptureStats 
+     */
+    CaptureStats since(const CaptureStats &previous) const
+    {
+        CaptureStats delta;
+        delta.received = received - previous.received;
+        delta.dropped = dropped - previous.dropped;
+        delta.interface_dropped = interface_dropped - previous.interface_dropped;
+        for (size_t i = 0; i < DECODE_STATUS_COUNT; i++)
+            delta.skipped[i] = skipped[i] - previous.skipped[i];
+        for (size_t i = 0; i < TRANSPORT_PROTOCOL_COUNT; i++)
+        {
+            delta.packets[i] = packets[i] - previous.packets[i];
+            delta.bytes[i] = bytes[i] - previous.bytes[i];
+        }
+        delta.inserted = inserted - previous.inserted;
+        delta.rejected = rejected - previous.rejected;
+        delta.retire_wait_ns = retire_wait_ns - previous.retire_wait_ns;
+        for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+            delta.latency[i] = latency[i] - previous.latency[i];
+        return delta;
+    }
+};
+
+DecodeStatus decodeEthernet(const struct pcap_pkthdr *, const u_char *, FlowRecord &);
+DecodeStatus decodeLinuxSll(const struct pcap_pkthdr *, const u_char *, FlowRecord &);
+DecodeStatus decodeLinuxSll2(const struct pcap_pkthdr *, const u_char *, FlowRecord &);
+DecodeStatus decodeRaw(const struct pcap_pkthdr *, const u_char *, FlowRecord &);
+DecodeStatus decodeNull(const struct pcap_pkthdr *, const u_char *, FlowRecord &);
+PacketDecoder decoderForLinkType(int link_type);
+const char *decodeStatusName(DecodeStatus);
+const char *transportProtocolName(TransportProtocol);
 void packet_handler(u_char *, const struct pcap_pkthdr*, const u_char*);
+void flushCaptureBatch(CaptureContext *);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,301 @@
+/**
+ * @file export_writer.cpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Writer thread exporting formatted periods to files.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "export_writer.hpp"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <cerrno>
+#include <cstring>
+#include <ctime>
+
+/**
+ * @brief Open the output and start the writer thread.
+ *
+ * Output file is opened right away, so an invalid path is reported before the capture starts.
+ *
+ * @param path output file, directory with per_period_files, or empty for stdout
+ * @param per_period_files write each period into a new file in the path directory
+ * @param options rotation and fsync of the output file
+ * @param header text starting every new file, e.g. CSV header
+ */
+ExportWriter::ExportWriter(const std::string &path, bool per_period_files, const ExportOptions &options, const std::string &header)
+    : head(0), queued(0), stopping(false), dropped(0), path(path), per_period_files(per_period_files), options(options),
+      header(header), fd(-1), file_size(0), unsynced(0), files(0)
+{
+    if (path.empty())
+    {
+        fd = STDOUT_FILENO;
+        writeAll(fd, header);
+    }
+    else if (!per_period_files)
+    {
+        openFile();
+    }
+    thread = std::thread(&ExportWriter::run, this);
+}
+
+/**
+ * @brief Write all queued periods and close the output, errors are no longer reported.
+ *
+ */
+ExportWriter::~ExportWriter()
+{
+    stop();
+}
+
+/**
+ * @brief Write all queued periods, then stop the writer thread and close the output.
+ *
+ */
+void ExportWriter::stop()
+{
+    if (!thread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m);
+        stopping = true;
+    }
+    queued_cv.notify_one();
+    thread.join();
+    if (fd >= 0 && !path.empty())
+        close(fd);
+    fd = -1;
+}
+
+/**
+ * @brief Write all queued periods and close the output, throw the error of the writer thread if any.
+ *
+ */
+void ExportWriter::finish()
+{
+    stop();
+    std::lock_guard<std::mutex> lock(m);
+    if (!error.empty())
+        throw std::runtime_error(error);
+}
+
+/**
+ * @brief Buffer for the next period, nullptr if the writer fell behind and the period is dropped.
+ *
+ * Lossless writer waits for the writer thread instead.
+ *
+ * Buffer is empty, its capacity is kept from the previous use. Fill it and call commitPeriod.
+ *
+ * @return std::string*
+ */
+std::string *ExportWriter::beginPeriod()
+{
+    std::unique_lock<std::mutex> lock(m);
+    if (options.lossless)
+        written_cv.wait(lock, [this] { return queued < EXPORT_QUEUE_PERIODS || !error.empty(); });
+    if (!error.empty())
+        throw std::runtime_error(error);
+    if (queued == EXPORT_QUEUE_PERIODS)
+    {
+        dropped.fetch_add(1, std::memory_order_relaxed);
+        return nullptr;
+    }
+
+    std::string *text = &buffers[(head + queued) % EXPORT_QUEUE_PERIODS];
+    text->clear();
+    return text;
+}
+
+/**
+ * @brief Queue the buffer filled since beginPeriod for the writer thread.
+ *
+ */
+void ExportWriter::commitPeriod()
+{
+    {
+        std::lock_guard<std::mutex> lock(m);
+        queued++;
+    }
+    queued_cv.notify_one();
+}
+
+/**
+ * @brief Writer thread, writes queued periods in order until stopped.
+ *
+ * Files are written without holding the lock. The buffer being written stays queued,
+ * so it is not handed out by beginPeriod until it is written.
+ */
+void ExportWriter::run()
+{
+    std::unique_lock<std::mutex> lock(m);
+    while (true)
+    {
+        queued_cv.wait(lock, [this] { return queued > 0 || stopping; });
+        if (queued == 0) // stopping
+            break;
+
+        const std::string &text = buffers[head];
+        bool failed = !error.empty();
+        lock.unlock();
+        if (!failed)
+        {
+            try
+            {
+                writePeriod(text);
+            }
+            catch (const std::exception &ex)
+            {
+                fail(ex.what());
+            }
+        }
+        lock.lock();
+        head = (head + 1) % EXPORT_QUEUE_PERIODS;
+        queued--;
+        written_cv.notify_one();
+    }
+    lock.unlock();
+
+    try
+    {
+        sync();
+    }
+    catch (const std::exception &ex)
+    {
+        fail(ex.what());
+    }
+}
+
+/**
+ * @brief Write one period, rotate the output file first if it is due.
+ *
+ * Screens are saved on a best effort basis, per-period file which cannot be written is skipped.
+ *
+ * @param text formatted period
+ */
+void ExportWriter::writePeriod(const std::string &text)
+{
+    if (per_period_files)
+    {
+        std::string file = path + "/out-" + std::to_string(files++) + ".txt";
+        int out = open(file.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (out < 0)
+            return;
+        try
+        {
+            writeAll(out, text);
+        }
+        catch (const std::exception &)
+        {
+        }
+        close(out);
+        return;
+    }
+
+    if (!path.empty())
+    {
+        bool full = options.rotate_size > 0 && file_size > header.size() && file_size + text.size() > options.rotate_size;
+        bool expired = options.rotate_interval > 0 &&
+                       std::chrono::steady_clock::now() - opened >= std::chrono::seconds(options.rotate_interval);
+        if (full || expired)
+            rotate();
+    }
+
+    writeAll(fd, text);
+    file_size += text.size();
+    unsynced++;
+    if (options.fsync_periods > 0 && unsynced >= options.fsync_periods)
+        sync();
+}
+
+/**
+ * @brief Write the whole text to the file.
+ *
+ * @param file descriptor
+ * @param text
+ */
+void ExportWriter::writeAll(int file, const std::string &text)
+{
+    size_t written = 0;
+    while (written < text.size())
+    {
+        ssize_t length = write(file, text.data() + written, text.size() - written);
+        if (length < 0 && errno == EINTR)
+            continue;
+        if (length < 0)
+            throw std::runtime_error(std::string("Cannot write records: ") + strerror(errno));
+        written += length;
+    }
+}
+
+/**
+ * @brief Open the output file for appending, write the header into an empty file.
+ *
+ */
+void ExportWriter::openFile()
+{
+    fd = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0)
+        throw std::runtime_error(path + ": " + strerror(errno));
+
+    off_t end = lseek(fd, 0, SEEK_END);
+    file_size = end > 0 ? end : 0;
+    opened = std::chrono::steady_clock::now();
+    if (file_size == 0)
+    {
+        writeAll(fd, header);
+        file_size = header.size();
+    }
+}
+
+/**
+ * @brief Rename the output file to file.YYYYmmdd-HHMMSS and continue in a new one.
+ *
+ */
+void ExportWriter::rotate()
+{
+    sync();
+    close(fd);
+    fd = -1;
+
+    char stamp[32];
+    time_t now = time(nullptr);
+    struct tm local;
+    localtime_r(&now, &local);
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", &local);
+
+    std::string rotated = path + "." + stamp;
+    for (int i = 1; access(rotated.c_str(), F_OK) == 0; i++) // Rotated more than once within a second
+        rotated = path + "." + stamp + "-" + std::to_string(i);
+    if (rename(path.c_str(), rotated.c_str()) != 0)
+        throw std::runtime_error(path + ": Cannot rotate: " + strerror(errno));
+    openFile();
+}
+
+/**
+ * @brief Flush the periods written since the last sync to the disk, if fsync is enabled.
+ *
+ */
+void ExportWriter::sync()
+{
+    if (options.fsync_periods == 0 || unsynced == 0 || path.empty() || per_period_files)
+        return;
+    if (fsync(fd) != 0)
+        throw std::runtime_error(path + ": Cannot sync: " + strerror(errno));
+    unsynced = 0;
+}
+
+/**
+ * @brief Remember the first error of the writer thread, the next beginPeriod throws it.
+ *
+ * @param message
+ */
+void ExportWriter::fail(const std::string &message)
+{
+    std::lock_guard<std::mutex> lock(m);
+    if (error.empty())
+        error = message;
+}
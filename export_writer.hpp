@@ -0,0 +1,94 @@
+/**
+ * @file export_writer.hpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Writer thread exporting formatted periods to files.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef EXPORT_WRITER_HPP
+#define EXPORT_WRITER_HPP
+
+#include <string>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+
+#define EXPORT_QUEUE_PERIODS 16 // formatted periods waiting for the writer thread
+
+/**
+ * @brief Rotation and durability of the export file.
+ *
+ */
+struct ExportOptions
+{
+    ExportOptions() : rotate_size(0), rotate_interval(0), fsync_periods(0), lossless(false) {}
+    size_t rotate_size;           // octets, file is rotated before it grows beyond, 0 to never rotate by size
+    unsigned int rotate_interval; // s, file is rotated this long after it was opened, 0 to never rotate by time
+    unsigned int fsync_periods;   // file is synced once per this many written periods, 0 to leave it to the kernel
+    bool lossless;                // wait for the writer instead of dropping periods, for replayed files
+};
+
+/**
+ * @brief Exports formatted periods on a dedicated thread, so slow disks never delay the refresh loop.
+ *
+ * The refresh loop formats each period into one of EXPORT_QUEUE_PERIODS buffers, which are reused
+ * in every period, and queues it. The writer thread writes the queued buffers in order. When all
+ * buffers are queued because the disk falls behind, the period is dropped and counted instead,
+ * unless the writer is lossless and waits for a buffer.
+ *
+ * Periods are appended to one output, stdout or a file rotated by size and time, or each period
+ * is written into a new file out-N.txt in a directory. Rotated files are renamed to
+ * file.YYYYmmdd-HHMMSS, header is written at the start of every new file.
+ *
+ * Buffers are filled by a single thread. Errors of the writer thread are thrown by the next beginPeriod
+ * or by finish, which writes the remaining periods.
+ */
+class ExportWriter
+{
+private:
+    std::mutex m;
+    std::condition_variable queued_cv;
+    std::condition_variable written_cv;
+    std::string buffers[EXPORT_QUEUE_PERIODS];
+    size_t head;   // oldest queued buffer
+    size_t queued; // buffers waiting for the writer thread
+    bool stopping;
+    std::string error; // first error of the writer thread
+    std::atomic<unsigned long long> dropped;
+
+    // Used by the writer thread only after the construction
+    std::string path; // output file or directory, empty for stdout
+    bool per_period_files;
+    ExportOptions options;
+    std::string header;
+    int fd;
+    size_t file_size;
+    std::chrono::steady_clock::time_point opened;
+    unsigned int unsynced;    // periods written since the last fsync
+    unsigned long long files; // per-period files written
+    std::thread thread;
+
+    void run();
+    void stop();
+    void writePeriod(const std::string &text);
+    void writeAll(int file, const std::string &text);
+    void openFile();
+    void rotate();
+    void sync();
+    void fail(const std::string &message);
+
+public:
+    ExportWriter(const std::string &path, bool per_period_files, const ExportOptions &options, const std::string &header);
+    ~ExportWriter();
+    std::string *beginPeriod();
+    void commitPeriod();
+    void finish();
+    unsigned long long droppedCount() const { return dropped.load(std::memory_order_relaxed); }
+};
+
+#endif
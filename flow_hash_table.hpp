@@ -0,0 +1,226 @@
+/**
+ * @file flow_hash_table.hpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Open-addressing hash table with preallocated capacity for flow records.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef FLOW_HASH_TABLE_HPP
+#define FLOW_HASH_TABLE_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <stdexcept>
+
+/**
+ * @brief Flat hash table mapping flow keys to records stored inline in the slots.
+ *
+ * Linear probing over a power-of-two slot array sized for load factor at most 0.5.
+ * All memory is allocated by the constructor, inserts never allocate. Slot is occupied
+ * only if its epoch matches the table epoch, so reset() is O(1). Table holds at most
+ * max_flows records, further inserts are rejected and counted.
+ *
+ * Batched callers may compute the hash once with hashOf(), prefetch the home slots
+ * of the whole batch and then pass the hash to findOrInsert().
+ *
+ * Records may be erased individually, erase() closes the gap by shifting the following
+ * records of the probe sequence back, so no tombstones are left behind.
+ *
+ * Not thread-safe.
+ *
+ * @tparam Key flow key, equality comparable
+ * @tparam Value record stored for each flow
+ * @tparam Hash hash function of the key
+ */
+template <typename Key, typename Value, typename Hash>
+class FlowHashTable
+{
+public:
+    struct Slot
+    {
+        uint32_t epoch;
+        uint32_t position; // index in used
+        Key key;
+        Value value;
+    };
+
+    explicit FlowHashTable(size_t max_flows_);
+
+    Value *find(const Key &key);
+    Value *findOrInsert(const Key &key, const Value &initial);
+    Value *findOrInsert(const Key &key, size_t key_hash, const Value &initial);
+    bool erase(const Key &key);
+    void reset();
+
+    size_t hashOf(const Key &key) const { return hash(key); }
+    // Hint the cache to load the home slot of the hash before it is probed
+    void prefetch(size_t key_hash) const { __builtin_prefetch(&slots[key_hash & mask], 1); }
+
+    size_t size() const { return used.size(); }
+    size_t maxFlows() const { return max_flows; }
+    unsigned long long rejected() const { return rejected_inserts; }
+
+    // Occupied slots in insertion order
+    size_t usedCount() const { return used.size(); }
+    const Slot &usedSlot(size_t i) const { return slots[used[i]]; }
+    Slot &usedSlot(size_t i) { return slots[used[i]]; }
+
+private:
+    std::vector<Slot> slots;
+    std::vector<uint32_t> used; // indices of occupied slots, capacity reserved up front
+    size_t mask;
+    size_t max_flows;
+    uint32_t epoch;
+    unsigned long long rejected_inserts;
+    Hash hash;
+};
+
+/**
+ * @brief Allocate slot array for max_flows records.
+ *
+ * @param max_flows_ maximal number of records
+ */
+template <typename Key, typename Value, typename Hash>
+FlowHashTable<Key, Value, Hash>::FlowHashTable(size_t max_flows_) : mask(0), max_flows(max_flows_), epoch(1), rejected_inserts(0)
+{
+    if (max_flows == 0 || max_flows > UINT32_MAX / 2)
+        throw std::invalid_argument("Invalid maximal number of flows");
+
+    size_t capacity = 1;
+    while (capacity < max_flows * 2)
+        capacity <<= 1;
+
+    slots.assign(capacity, Slot());
+    used.reserve(max_flows);
+    mask = capacity - 1;
+}
+
+/**
+ * @brief Find record of the key.
+ *
+ * @param key
+ * @return Value* record or nullptr if not present
+ */
+template <typename Key, typename Value, typename Hash>
+Value *FlowHashTable<Key, Value, Hash>::find(const Key &key)
+{
+    for (size_t i = hash(key) & mask;; i = (i + 1) & mask)
+    {
+        Slot &slot = slots[i];
+        if (slot.epoch != epoch)
+            return nullptr;
+        if (slot.key == key)
+            return &slot.value;
+    }
+}
+
+/**
+ * @brief Find record of the key, insert initial value if not present.
+ *
+ * @param key
+ * @param initial value of the new record
+ * @return Value* record or nullptr if table is full
+ */
+template <typename Key, typename Value, typename Hash>
+Value *FlowHashTable<Key, Value, Hash>::findOrInsert(const Key &key, const Value &initial)
+{
+    return findOrInsert(key, hash(key), initial);
+}
+
+/**
+ * @brief Find record of the key with precomputed hash, insert initial value if not present.
+ *
+ * @param key
+ * @param key_hash hashOf(key)
+ * @param initial value of the new record
+ * @return Value* record or nullptr if table is full
+ */
+template <typename Key, typename Value, typename Hash>
+Value *FlowHashTable<Key, Value, Hash>::findOrInsert(const Key &key, size_t key_hash, const Value &initial)
+{
+    for (size_t i = key_hash & mask;; i = (i + 1) & mask)
+    {
+        Slot &slot = slots[i];
+        if (slot.epoch != epoch)
+        {
+            if (used.size() >= max_flows)
+            {
+                rejected_inserts++;
+                return nullptr;
+            }
+            slot.epoch = epoch;
+            slot.position = (uint32_t)used.size();
+            slot.key = key;
+            slot.value = initial;
+            used.push_back((uint32_t)i);
+            return &slot.value;
+        }
+        if (slot.key == key)
+            return &slot.value;
+    }
+}
+
+/**
+ * @brief Remove record of the key.
+ *
+ * Records of the probe sequence after the erased one are moved back if their home slot
+ * allows it, so lookups never stop at the freed slot too early. Order of used changes.
+ *
+ * @param key
+ * @return true if the record was present
+ */
+template <typename Key, typename Value, typename Hash>
+bool FlowHashTable<Key, Value, Hash>::erase(const Key &key)
+{
+    size_t hole = hash(key) & mask;
+    for (;; hole = (hole + 1) & mask)
+    {
+        if (slots[hole].epoch != epoch)
+            return false;
+        if (slots[hole].key == key)
+            break;
+    }
+
+    // Remove from the list of occupied slots, the last one takes its place
+    uint32_t position = slots[hole].position;
+    used[position] = used.back();
+    slots[used[position]].position = position;
+    used.pop_back();
+
+    for (size_t i = (hole + 1) & mask; slots[i].epoch == epoch; i = (i + 1) & mask)
+    {
+        size_t home = hash(slots[i].key) & mask;
+        // Record may move to the hole only if its home is not cyclically within (hole, i]
+        bool home_after_hole = hole <= i ? (home > hole && home <= i) : (home > hole || home <= i);
+        if (home_after_hole)
+            continue;
+
+        slots[hole] = slots[i];
+        used[slots[hole].position] = (uint32_t)hole;
+        hole = i;
+    }
+    slots[hole].epoch = 0; // never matches, table epoch starts at 1
+    return true;
+}
+
+/**
+ * @brief Remove all records by moving to the next epoch.
+ *
+ */
+template <typename Key, typename Value, typename Hash>
+void FlowHashTable<Key, Value, Hash>::reset()
+{
+    used.clear();
+    rejected_inserts = 0;
+    if (++epoch == 0) // Wrapped around, stale slots could match again
+    {
+        for (Slot &slot : slots)
+            slot.epoch = 0;
+        epoch = 1;
+    }
+}
+
+#endif
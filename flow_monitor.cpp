@@ -11,6 +11,11 @@
 #include <iostream>
 #include <string.h>
 #include <stdexcept>
+#include <thread>
+#include <cerrno>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <linux/if_packet.h>
 
 
 #include "flow_table.hpp"
@@ -18,67 +23,476 @@
 #include "capturing_utils.hpp"
 
 #define PROMISCUOUS 1
-#define UNLIMITED 0
+#define WHOLE_BUFFER -1 // pcap_dispatch processes all packets of one buffer
+#define USEC_PER_SEC 1000000LL
+#define DEFAULT_FILTER "ip or ip6" // only packets which can be accounted cross into userspace
+#define FILTER_SNAPLEN 65535
 
 
 /**
  * @brief Construct a new Flow Monitor:: Flow Monitor object
  * 
- * @param interface interface to capture packets on
+ * With more than one thread, capture sockets join one PACKET_FANOUT group which distributes
+ * packets by symmetric flow hash, so both directions of a flow reach the same worker.
+ * 
+ * @param options capture options - interface, number of capture threads, backend
  * @param key key used to sort value in flow table - Bytes | Packets
+ * @param max_flows maximal number of flows tracked within one period by each thread
+ * @param top_flows number of top flows reported for each period
+ * @param sketch_counters flows monitored by the sketch of each thread, 0 for exact flow tables
+ */
+FlowMonitor::FlowMonitor(const CaptureOptions &options, SortKey key, size_t max_flows, size_t top_flows, size_t sketch_counters)
+    : sort_key(key), top_flows(top_flows), pending_header(nullptr), pending_packet(nullptr), period_end(0), replayed_end(0)
+{
+    int fanout_group = options.threads > 1 ? (getpid() & 0xffff) : -1;
+    unsigned int threads = options.file != nullptr ? 1 : options.threads; // file is replayed by one thread
+
+    try
+    {
+        for (unsigned int i = 0; i < threads; i++)
+        {
+            workers.emplace_back(new CaptureWorker(max_flows, sketch_counters));
+            workers.back()->table.setSortKey(key);
+            workers.back()->table.setTopFlows(top_flows);
+            workers.back()->timed = options.timed;
+            if (options.file != nullptr)
+            {
+                openFile(*workers.back(), options);
+            }
+            else
+            {
+                openCapture(*workers.back(), options, fanout_group);
+            }
+        }
+    }
+    catch (...)
+    {
+        close();
+        throw;
+    }
+}
+
+/**
+ * @brief Release capture handles.
+ * 
+ */
+FlowMonitor::~FlowMonitor()
+{
+    close();
+}
+
+/**
+ * @brief Compile the filter expression for the link type of the handle.
+ * 
+ * @param handle opened or dead pcap handle
+ * @param expression pcap filter expression
+ * @param program compiled program, must be released by pcap_freecode
+ */
+static void compileFilter(pcap_t *handle, const char *expression, struct bpf_program &program)
+{
+    if (pcap_compile(handle, &program, expression, 1, PCAP_NETMASK_UNKNOWN) != 0)
+    {
+        throw std::invalid_argument(std::string("Invalid filter \"") + expression + "\": " + pcap_geterr(handle));
+    }
+}
+
+/**
+ * @brief Compile the filter and install it on the pcap handle.
+ * 
+ * @param handle 
+ * @param expression pcap filter expression
  */
-FlowMonitor::FlowMonitor(const char *interface, SortKey key)
+static void setFilter(pcap_t *handle, const char *expression)
+{
+    struct bpf_program program;
+    compileFilter(handle, expression, program);
+    int status = pcap_setfilter(handle, &program);
+    pcap_freecode(&program);
+    if (status != 0)
+    {
+        throw std::runtime_error(std::string("Cannot set filter: ") + pcap_geterr(handle));
+    }
+}
+
+/**
+ * @brief Throw if an option could not be set on the pcap handle before its activation.
+ * 
+ * @param status return value of pcap_set_*
+ * @param option name of the option for the message
+ */
+static void checkOption(int status, const char *option)
+{
+    if (status != 0)
+    {
+        throw std::invalid_argument(std::string("Cannot set ") + option + ": " + pcap_statustostr(status));
+    }
+}
+
+/**
+ * @brief Open live capture for the worker and join the fanout group.
+ * 
+ * Snaplen, buffer size and immediate mode are applied only to the libpcap backend,
+ * size of the TPACKET ring is given by its blocks. Filter runs in the kernel, without
+ * user filter only ipv4 and ipv6 packets are captured.
+ * 
+ * @param worker 
+ * @param options capture options
+ * @param fanout_group PACKET_FANOUT group id, negative if fanout is not used
+ */
+void FlowMonitor::openCapture(CaptureWorker &worker, const CaptureOptions &options, int fanout_group)
 {
     char error_buffer[PCAP_ERRBUF_SIZE];
-    int timeout_limit = 1000; // 1s
+
+    const char *filter = options.filter != nullptr ? options.filter : DEFAULT_FILTER;
+
+    if (options.backend == CaptureBackend::TPACKET)
+    {
+        // Ring socket passes network layer packets
+        pcap_t *dead = pcap_open_dead(DLT_RAW, FILTER_SNAPLEN);
+        if (dead == nullptr)
+        {
+            throw std::runtime_error("Cannot compile filter");
+        }
+        struct bpf_program program;
+        try
+        {
+            compileFilter(dead, filter, program);
+        }
+        catch (...)
+        {
+            pcap_close(dead);
+            throw;
+        }
+
+        try
+        {
+            worker.ring.reset(new TpacketRing(options.interface, options.block_size, options.block_count, options.timeout, fanout_group, &program));
+        }
+        catch (...)
+        {
+            pcap_freecode(&program);
+            pcap_close(dead);
+            throw;
+        }
+        pcap_freecode(&program);
+        pcap_close(dead);
+        worker.decoder = decodeRaw;
+        return;
+    }
 
     // live capture
-    handle = pcap_open_live(
-        interface,
-        BUFSIZ,
-        PROMISCUOUS,
-        timeout_limit,
-        error_buffer);
+    worker.handle = pcap_create(options.interface, error_buffer);
+    if (worker.handle == nullptr)
+    {
+        throw std::invalid_argument(error_buffer);
+    }
 
-    if (handle == nullptr)
+    checkOption(pcap_set_snaplen(worker.handle, options.snaplen), "snaplen");
+    checkOption(pcap_set_promisc(worker.handle, PROMISCUOUS), "promiscuous mode");
+    checkOption(pcap_set_timeout(worker.handle, options.timeout), "timeout");
+    if (options.immediate)
     {
-        std::string err = std::string(error_buffer, PCAP_ERRBUF_SIZE);
-        throw std::invalid_argument(err);
+        checkOption(pcap_set_immediate_mode(worker.handle, 1), "immediate mode");
+    }
+    if (options.buffer_size > 0)
+    {
+        checkOption(pcap_set_buffer_size(worker.handle, options.buffer_size), "buffer size");
+    }
+
+    int status = pcap_activate(worker.handle);
+    if (status < 0) // warnings are ignored
+    {
+        std::string err = status == PCAP_ERROR ? pcap_geterr(worker.handle) : pcap_statustostr(status);
+        throw std::invalid_argument(std::string(options.interface) + ": " + err);
+    }
+    selectDecoder(worker, options.interface);
+    setFilter(worker.handle, filter);
+
+    if (fanout_group >= 0)
+    {
+        int fanout = fanout_group | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+        if (setsockopt(pcap_fileno(worker.handle), SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) != 0)
+        {
+            throw std::runtime_error(std::string("Cannot join packet fanout group: ") + strerror(errno));
+        }
+    }
+}
+
+/**
+ * @brief Open the capture file for replay.
+ * 
+ * @param worker 
+ * @param options capture options
+ */
+void FlowMonitor::openFile(CaptureWorker &worker, const CaptureOptions &options)
+{
+    char error_buffer[PCAP_ERRBUF_SIZE];
+    worker.handle = pcap_open_offline(options.file, error_buffer);
+    if (worker.handle == nullptr)
+    {
+        throw std::invalid_argument(error_buffer);
+    }
+    worker.offline = true;
+    selectDecoder(worker, options.file);
+    if (options.filter != nullptr) // file is not filtered by default, nothing is copied from the kernel
+    {
+        setFilter(worker.handle, options.filter);
     }
-    table.setSortKey(key);
 }
 
 /**
- * @brief Start capturing loop with given packet_handler.
+ * @brief Select decoder for the link type of the opened pcap handle.
+ * 
+ * @param worker 
+ * @param source interface or file name for the error message
+ */
+void FlowMonitor::selectDecoder(CaptureWorker &worker, const char *source)
+{
+    int link_type = pcap_datalink(worker.handle);
+    worker.decoder = decoderForLinkType(link_type);
+    if (worker.decoder == nullptr)
+    {
+        throw std::invalid_argument(std::string(source) + ": Unsupported link type " + std::to_string(link_type));
+    }
+}
+
+/**
+ * @brief Capturing loop of one worker.
+ * 
+ * Packets are processed one kernel buffer (or ring block) at a time, packets of the buffer
+ * are applied to the flow table in batches. The batch is on the stack of the capture thread.
+ * Capture file is read until its end.
+ * 
+ * @param worker 
+ */
+void FlowMonitor::capture(CaptureWorker *worker)
+{
+    CaptureContext context(&worker->table, worker->decoder, &worker->counters, worker->timed);
+
+    if (worker->ring)
+    {
+        worker->ring->loop(packet_handler, &context);
+        return;
+    }
+    // Returns negative value on error or when pcap_breakloop is called
+    int processed;
+    while ((processed = pcap_dispatch(worker->handle, WHOLE_BUFFER, packet_handler, (u_char *)&context)) >= 0)
+    {
+        flushCaptureBatch(&context);
+        if (worker->offline)
+        {
+            if (processed == 0) // end of file
+                break;
+            worker->packets += processed;
+        }
+    }
+}
+
+/**
+ * @brief Start capturing loops with given packet_handler, returns when all of them are stopped.
  * 
  */
 void FlowMonitor::start()
 {
-    void *args[2] = {&table, &handle};
-    
-    pcap_loop(handle, UNLIMITED, packet_handler, (u_char *)args);
+    std::vector<std::thread> threads;
+    for (size_t i = 1; i < workers.size(); i++)
+    {
+        threads.emplace_back(&FlowMonitor::capture, workers[i].get());
+    }
+
+    capture(workers[0].get());
+
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+}
+
+/**
+ * @brief Replay packets of the capture file up to the end of the next period.
+ * 
+ * Periods are derived from the packet timestamps, the first one starts with the first packet,
+ * so the replay splits the file into the same periods regardless of the processing speed.
+ * 
+ * @param period period length in seconds
+ * @return false if the end of the file was reached
+ */
+bool FlowMonitor::replayPeriod(unsigned int period)
+{
+    CaptureWorker *worker = workers[0].get();
+    CaptureContext context(&worker->table, worker->decoder, &worker->counters, worker->timed);
+
+    bool more = true;
+    while (true)
+    {
+        if (pending_header == nullptr)
+        {
+            if (pcap_next_ex(worker->handle, &pending_header, &pending_packet) != 1) // end of file or error
+            {
+                pending_header = nullptr;
+                more = false;
+                break;
+            }
+        }
+
+        long long timestamp = pending_header->ts.tv_sec * USEC_PER_SEC + pending_header->ts.tv_usec;
+        if (period_end == 0) // first packet
+            period_end = timestamp + period * USEC_PER_SEC;
+        if (timestamp >= period_end)
+            break;
+
+        packet_handler((u_char *)&context, pending_header, pending_packet);
+        worker->packets++;
+        pending_header = nullptr;
+    }
+
+    flushCaptureBatch(&context);
+    replayed_end = period_end;
+    period_end += period * USEC_PER_SEC;
+    return more;
+}
+
+/**
+ * @brief Number of packets replayed from the capture file.
+ * 
+ * @return unsigned long long 
+ */
+unsigned long long FlowMonitor::getPacketCount()
+{
+    return workers[0]->packets;
 }
 
 /**
- * @brief Stop capturing loop.
+ * @brief Stop capturing loops.
  * 
  */
 void FlowMonitor::stop()
 {
-    if (handle != nullptr)
+    for (std::unique_ptr<CaptureWorker> &worker : workers)
+    {
+        if (worker->ring)
+        {
+            worker->ring->breakloop();
+        }
+        if (worker->handle != nullptr)
+        {
+            pcap_breakloop(worker->handle);
+        }
+    }
+}
+
+/**
+ * @brief Close capture handles, capturing loops must not be running.
+ * 
+ */
+void FlowMonitor::close()
+{
+    for (std::unique_ptr<CaptureWorker> &worker : workers)
     {
-        pcap_breakloop(handle);
+        worker->ring.reset();
+        if (worker->handle != nullptr)
+        {
+            pcap_close(worker->handle);
+            worker->handle = nullptr;
+        }
     }
-    pcap_close(handle);
-    handle = nullptr;
 }
 
 /**
- * @brief Get gathered flow statistics from the FlowMonitor FlowTable.
+ * @brief Keep flows across periods, getHistory is used instead of getData.
  * 
- * @return std::list<std::pair<FlowKey, FlowStats>> 
+ * @param max_flows maximal number of kept flows, least recently seen flow is evicted beyond it
+ * @param idle_periods flow is forgotten when it is not seen for idle_periods periods
+ * @param period period length in seconds
  */
-std::list<std::pair<FlowKey, FlowStats>> FlowMonitor::getData()
+void FlowMonitor::keepFlows(size_t max_flows, unsigned int idle_periods, unsigned int period)
 {
-    return table.getStatistics();
+    store.reset(new FlowStore(max_flows, idle_periods, period));
+}
+
+/**
+ * @brief End the period, add its flows to the store and return top stored flows.
+ * 
+ * @return const HistorySnapshot& valid until the next call
+ */
+const HistorySnapshot &FlowMonitor::getHistory()
+{
+    for (std::unique_ptr<CaptureWorker> &worker : workers)
+        worker->table.collectStatistics(*store);
+    store->advance();
+    history.clear();
+    store->getStatistics(history, sort_key, top_flows);
+    return history;
+}
+
+/**
+ * @brief Get gathered flow statistics from the FlowMonitor FlowTable shards.
+ * 
+ * Records of the previous period are released at once by clearing the snapshot.
+ * 
+ * @return const FlowSnapshot& valid until the next call
+ */
+const FlowSnapshot &FlowMonitor::getData()
+{
+    snapshot.clear();
+    for (std::unique_ptr<CaptureWorker> &worker : workers)
+    {
+        worker->table.getStatistics(snapshot);
+    }
+    if (workers.size() > 1)
+    {
+        workers[0]->table.mergeStatistics(snapshot);
+    }
+    return snapshot;
+}
+
+/**
+ * @brief Capture and pipeline counters summed over all capture sockets and their threads.
+ * 
+ * Kernel counters are accumulated by each call, so it must be called by one thread only.
+ * 
+ * @return CaptureStats 
+ */
+CaptureStats FlowMonitor::getCaptureStats()
+{
+    CaptureStats total;
+    for (std::unique_ptr<CaptureWorker> &worker : workers)
+    {
+        CaptureStats stats;
+        if (worker->ring)
+        {
+            stats = worker->ring->stats();
+        }
+        else if (worker->handle != nullptr)
+        {
+            // libpcap counters are 32-bit and wrap, the difference since the last call is added
+            struct pcap_stat pcap_stats_;
+            if (pcap_stats(worker->handle, &pcap_stats_) == 0)
+            {
+                worker->pcap_totals.received += (uint32_t)(pcap_stats_.ps_recv - worker->pcap_last.ps_recv);
+                worker->pcap_totals.dropped += (uint32_t)(pcap_stats_.ps_drop - worker->pcap_last.ps_drop);
+                worker->pcap_totals.interface_dropped += (uint32_t)(pcap_stats_.ps_ifdrop - worker->pcap_last.ps_ifdrop);
+                worker->pcap_last = pcap_stats_;
+            }
+            stats = worker->pcap_totals;
+        }
+        total.received += stats.received;
+        total.dropped += stats.dropped;
+        total.interface_dropped += stats.interface_dropped;
+        for (size_t i = 0; i < DECODE_STATUS_COUNT; i++)
+            total.skipped[i] += worker->counters.skipped[i].load(std::memory_order_relaxed);
+        for (size_t i = 0; i < TRANSPORT_PROTOCOL_COUNT; i++)
+        {
+            total.packets[i] += worker->counters.packets[i].load(std::memory_order_relaxed);
+            total.bytes[i] += worker->counters.bytes[i].load(std::memory_order_relaxed);
+        }
+        for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+            total.latency[i] += worker->counters.latency[i].load(std::memory_order_relaxed);
+
+        FlowTableCounters table = worker->table.getCounters();
+        total.inserted += table.inserted;
+        total.rejected += table.rejected;
+        total.retire_wait_ns += table.retire_wait_ns;
+    }
+    return total;
 }
\ No newline at end of file
@@ -10,19 +10,65 @@
 #define CAPTURE_HPP
 
 #include <pcap.h>
+#include <vector>
+#include <memory>
 #include "flow_table.hpp"
+#include "flow_store.hpp"
+#include "capturing_utils.hpp"
+#include "tpacket_capture.hpp"
+#include "capture_options.hpp"
 
+/**
+ * @brief Capture socket with its private flow table shard, served by one capture thread.
+ * 
+ */
+struct CaptureWorker
+{
+    CaptureWorker(size_t max_flows, size_t sketch_counters)
+        : handle(nullptr), decoder(nullptr), offline(false), timed(false), packets(0), pcap_last(), table(max_flows, sketch_counters) {}
+    pcap_t *handle;
+    std::unique_ptr<TpacketRing> ring; // used instead of handle with the TPACKET backend
+    PacketDecoder decoder;             // decoder of the link type of the capture
+    bool offline;                      // handle reads a capture file
+    bool timed;                        // handler latency of every packet is counted
+    unsigned long long packets;        // packets read from the capture file
+    DecodeCounters counters;           // packets not accounted by the reason, accounted packets by the protocol
+    struct pcap_stat pcap_last;        // libpcap counters read by the last getCaptureStats
+    CaptureStats pcap_totals;          // libpcap counters since the start, without the 32-bit wrap
+    FlowTable table;
+};
 
 class FlowMonitor
 {
 private:
-    pcap_t *handle;
-    FlowTable table;
+    std::vector<std::unique_ptr<CaptureWorker>> workers;
+    std::unique_ptr<FlowStore> store; // flows kept across periods in cumulative mode
+    SortKey sort_key;
+    size_t top_flows;
+    FlowSnapshot snapshot;   // top flows of the last period, reused in every period
+    HistorySnapshot history; // top stored flows in cumulative mode, reused in every period
+    // Replay state, packet read beyond the end of the period is kept for the next one
+    struct pcap_pkthdr *pending_header;
+    const u_char *pending_packet;
+    long long period_end; // us
+    long long replayed_end; // us, end of the last replayed period
+    void openCapture(CaptureWorker &worker, const CaptureOptions &options, int fanout_group);
+    void openFile(CaptureWorker &worker, const CaptureOptions &options);
+    static void selectDecoder(CaptureWorker &worker, const char *source);
+    static void capture(CaptureWorker *worker);
+    void close();
 public:
-    FlowMonitor(const char *, SortKey key);
+    FlowMonitor(const CaptureOptions &options, SortKey key, size_t max_flows, size_t top_flows, size_t sketch_counters);
+    ~FlowMonitor();
     void start();
     void stop();
-    std::list<std::pair<FlowKey, FlowStats>> getData();
+    void keepFlows(size_t max_flows, unsigned int idle_periods, unsigned int period);
+    bool replayPeriod(unsigned int period);
+    long long replayTime() const { return replayed_end; }
+    unsigned long long getPacketCount();
+    const FlowSnapshot &getData();
+    const HistorySnapshot &getHistory();
+    CaptureStats getCaptureStats();
 };
 
 #endif
\ No newline at end of file
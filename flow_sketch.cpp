@@ -0,0 +1,228 @@
+/**
+ * @file flow_sketch.cpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Fixed-memory heavy-hitter tracking with Space-Saving backed by Count-Min.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "flow_sketch.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+#define COUNT_MIN_SEED 0x6a09e667f3bcc909ULL // mixed into the index seed, rows are independent of the index
+
+/**
+ * @brief Allocate counters, index and Count-Min rows.
+ *
+ * @param max_counters number of monitored flows k, Count-Min width is SKETCH_WIDTH_FACTOR * k
+ *                     rounded up to a power of two
+ */
+FlowSketch::FlowSketch(size_t max_counters)
+    : index(max_counters), counters(max_counters), width_mask(0), hash(FlowKeyHash().seed ^ COUNT_MIN_SEED), total(0),
+      replacements(0)
+{
+    size_t width = 1;
+    while (width < max_counters * SKETCH_WIDTH_FACTOR)
+        width <<= 1;
+    width_mask = width - 1;
+
+    count_min.assign(SKETCH_DEPTH * width, 0);
+    heap.reserve(max_counters);
+    ranking.reserve(max_counters);
+    estimates.assign(max_counters, 0);
+}
+
+/**
+ * @brief Add weight to the Count-Min cells of the key.
+ *
+ * Row columns are derived from one 64-bit hash by double hashing.
+ *
+ * @param key
+ * @param weight
+ */
+void FlowSketch::countMinAdd(const FlowKey &key, unsigned long long weight)
+{
+    uint64_t h = hash(key);
+    uint32_t h1 = (uint32_t)h;
+    uint32_t h2 = (uint32_t)(h >> 32) | 1;
+    for (size_t row = 0; row < SKETCH_DEPTH; row++)
+        count_min[row * (width_mask + 1) + ((h1 + row * h2) & width_mask)] += weight;
+}
+
+/**
+ * @brief Upper bound of the weight of the monitored flow, the smaller of Space-Saving and Count-Min.
+ *
+ * @param counter
+ * @return unsigned long long
+ */
+unsigned long long FlowSketch::estimate(const SketchCounter &counter) const
+{
+    uint64_t h = hash(counter.key);
+    uint32_t h1 = (uint32_t)h;
+    uint32_t h2 = (uint32_t)(h >> 32) | 1;
+    unsigned long long estimate = counter.count;
+    for (size_t row = 0; row < SKETCH_DEPTH; row++)
+        estimate = std::min(estimate, count_min[row * (width_mask + 1) + ((h1 + row * h2) & width_mask)]);
+    return estimate;
+}
+
+void FlowSketch::swapHeap(size_t a, size_t b)
+{
+    std::swap(heap[a], heap[b]);
+    counters[heap[a]].heap_position = (uint32_t)a;
+    counters[heap[b]].heap_position = (uint32_t)b;
+}
+
+/**
+ * @brief Restore the heap after the count at position increased.
+ *
+ * @param position
+ */
+void FlowSketch::siftDown(size_t position)
+{
+    while (true)
+    {
+        size_t smallest = position;
+        size_t left = 2 * position + 1;
+        size_t right = left + 1;
+        if (left < heap.size() && counters[heap[left]].count < counters[heap[smallest]].count)
+            smallest = left;
+        if (right < heap.size() && counters[heap[right]].count < counters[heap[smallest]].count)
+            smallest = right;
+        if (smallest == position)
+            return;
+        swapHeap(position, smallest);
+        position = smallest;
+    }
+}
+
+/**
+ * @brief Restore the heap after a counter was appended at position.
+ *
+ * @param position
+ */
+void FlowSketch::siftUp(size_t position)
+{
+    while (position > 0)
+    {
+        size_t parent = (position - 1) / 2;
+        if (counters[heap[parent]].count <= counters[heap[position]].count)
+            return;
+        swapHeap(position, parent);
+        position = parent;
+    }
+}
+
+/**
+ * @brief Count one packet of the flow.
+ *
+ * @param key canonical flow key
+ * @param reversed packet direction is opposite to the canonical key
+ * @param bytes packet length
+ * @param sort_key bytes or packets are the weight
+ */
+void FlowSketch::add(const FlowKey &key, bool reversed, uint32_t bytes, SortKey sort_key)
+{
+    unsigned long long weight = sort_key == SortKey::BYTES ? bytes : 1;
+    total += weight;
+    countMinAdd(key, weight);
+
+    uint32_t *found = index.find(key);
+    if (found != nullptr) // Monitored
+    {
+        SketchCounter &counter = counters[*found];
+        counter.count += weight;
+        counter.entry.account(reversed, bytes);
+        siftDown(counter.heap_position);
+        return;
+    }
+
+    uint32_t id;
+    unsigned long long error = 0;
+    bool replaced = heap.size() == counters.size();
+    if (!replaced) // Free counter, the flow was not seen yet
+    {
+        id = (uint32_t)heap.size();
+        heap.push_back(id);
+        counters[id].heap_position = id;
+    }
+    else // Replace the flow with the minimal count
+    {
+        id = heap[0];
+        error = counters[id].count;
+        index.erase(counters[id].key);
+        replacements++;
+    }
+
+    SketchCounter &counter = counters[id];
+    index.findOrInsert(key, id);
+    counter.key = key;
+    counter.entry = FlowEntry(reversed);
+    counter.count = error + weight;
+    counter.error = error;
+    counter.entry.account(reversed, bytes);
+    if (replaced)
+        siftDown(counter.heap_position);
+    else
+        siftUp(counter.heap_position);
+}
+
+/**
+ * @brief Forget all flows, called at the end of the period.
+ *
+ */
+void FlowSketch::reset()
+{
+    index.reset();
+    heap.clear();
+    std::fill(count_min.begin(), count_min.end(), 0);
+    total = 0;
+    replacements = 0;
+}
+
+/**
+ * @brief Append top monitored flows to the snapshot.
+ *
+ * Flows are selected by the estimate of their weight, the appended statistics hold only packets
+ * counted since the flow is monitored. Without replaced flows the selection is exact. Flows are
+ * appended by the statistics from the most to the least communicating flow, like
+ * FlowTable::getStatistics.
+ *
+ * @param snapshot
+ * @param sort_key
+ * @param top_flows number of appended flows
+ */
+void FlowSketch::getStatistics(FlowSnapshot &snapshot, SortKey sort_key, size_t top_flows)
+{
+    ranking.clear();
+    for (size_t i = 0; i < heap.size(); i++)
+    {
+        ranking.push_back(heap[i]);
+        if (replacements > 0)
+            estimates[heap[i]] = estimate(counters[heap[i]]);
+        else // Exact
+            estimates[heap[i]] = rankValue(counters[heap[i]].entry.stats, sort_key);
+    }
+
+    size_t count = std::min(ranking.size(), top_flows);
+    if (count < ranking.size())
+    {
+        const std::vector<unsigned long long> &estimated = estimates;
+        std::nth_element(ranking.begin(), ranking.begin() + count, ranking.end(), [&estimated](size_t a, size_t b) {
+            return estimated[a] > estimated[b];
+        });
+    }
+
+    const std::vector<SketchCounter> &monitored = counters;
+    std::sort(ranking.begin(), ranking.begin() + count, [&monitored, sort_key](size_t a, size_t b) {
+        return rankValue(monitored[a].entry.stats, sort_key) > rankValue(monitored[b].entry.stats, sort_key);
+    });
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const SketchCounter &counter = counters[ranking[i]];
+        snapshot.push_back({counter.entry.reversed ? counter.key.swapped() : counter.key, counter.entry.stats});
+    }
+}
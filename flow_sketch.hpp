@@ -0,0 +1,90 @@
+/**
+ * @file flow_sketch.hpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Fixed-memory heavy-hitter tracking with Space-Saving backed by Count-Min.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef FLOW_SKETCH_HPP
+#define FLOW_SKETCH_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include "flow_types.hpp"
+#include "flow_hash_table.hpp"
+
+#define SKETCH_DEPTH 4        // Count-Min rows
+#define SKETCH_WIDTH_FACTOR 4 // Count-Min columns per Space-Saving counter
+
+/**
+ * @brief Space-Saving counter of a monitored flow.
+ *
+ * count - error <= true weight <= count. Entry holds only the packets counted since the
+ * flow is monitored, so its statistics are lower bounds.
+ */
+struct SketchCounter
+{
+    FlowKey key; // canonical
+    FlowEntry entry;
+    unsigned long long count; // estimated weight (bytes or packets)
+    unsigned long long error; // overestimation inherited when the flow replaced another one
+    uint32_t heap_position;
+};
+
+/**
+ * @brief Top flows of one period in memory fixed by the number of counters.
+ *
+ * Space-Saving monitors at most counters flows, kept in a min-heap by their count. A flow
+ * which is not monitored replaces the flow with the minimal count m and starts at m + weight.
+ * All flows are also counted by a Count-Min sketch, flows are ranked by the smaller of
+ * the two estimates, which tightens the overestimation of flows admitted late in the period.
+ *
+ * Error bounds for total weight N of the period, k counters, Count-Min width w and depth d:
+ *  - every flow with weight above N / k is monitored,
+ *  - estimate overestimates the weight by at most min(N / k, e * N / w), the Count-Min part
+ *    holds with probability at least 1 - e^-d.
+ *
+ * While no flow was replaced, the statistics are exact and the top flows are selected like in
+ * FlowTable, by the statistics instead of the estimates.
+ *
+ * Weight is the octet count when sorting by bytes, packet count when sorting by packets.
+ * Not thread-safe, updated by one capture thread.
+ */
+class FlowSketch
+{
+private:
+    FlowHashTable<FlowKey, uint32_t, FlowKeyHash> index; // flow key -> counter
+    std::vector<SketchCounter> counters;
+    std::vector<uint32_t> heap; // counters by count, minimum first
+    std::vector<unsigned long long> count_min; // depth rows of width cells
+    size_t width_mask;
+    FlowKeyHash hash;
+    std::vector<size_t> ranking; // Scratch space for selecting the top flows
+    std::vector<unsigned long long> estimates; // Scratch space, estimates by counter
+    unsigned long long total;
+    unsigned long long replacements; // flows replaced in the period, statistics are exact while 0
+
+    void siftDown(size_t position);
+    void siftUp(size_t position);
+    void swapHeap(size_t a, size_t b);
+    void countMinAdd(const FlowKey &key, unsigned long long weight);
+
+public:
+    explicit FlowSketch(size_t max_counters);
+    void add(const FlowKey &key, bool reversed, uint32_t bytes, SortKey sort_key);
+    void reset();
+    void getStatistics(FlowSnapshot &snapshot, SortKey sort_key, size_t top_flows);
+
+    size_t size() const { return heap.size(); }
+    const SketchCounter &counter(size_t i) const { return counters[heap[i]]; }
+    unsigned long long estimate(const SketchCounter &counter) const;
+    unsigned long long totalWeight() const { return total; }
+    size_t maxCounters() const { return counters.size(); }
+    size_t width() const { return width_mask + 1; }
+};
+
+#endif
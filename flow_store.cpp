@@ -0,0 +1,340 @@
+/**
+ * @file flow_store.cpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Bounded store of flows kept across periods with cumulative statistics.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "flow_store.hpp"
+#include <algorithm>
+#include <stdexcept>
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+
+static const unsigned int WINDOW_SECONDS[RATE_WINDOWS] = {2, 10, 40};
+
+/**
+ * @brief Allocate all flows and the index for max_flows flows.
+ *
+ * Averaging windows are rounded to whole periods, at least one and at most RATE_RING_PERIODS.
+ *
+ * @param max_flows maximal number of stored flows
+ * @param idle_periods flow expires when it is not seen for idle_periods periods
+ * @param period period length in seconds
+ */
+FlowStore::FlowStore(size_t max_flows, unsigned int idle_periods_, unsigned int period_)
+    : index(max_flows), flows(max_flows), free_flows(NO_FLOW), now(0), idle_periods(idle_periods_), period(period_),
+      expired(0), evicted(0)
+{
+    if (idle_periods == 0 || idle_periods > UINT32_MAX / 2)
+        throw std::invalid_argument("Invalid idle timeout");
+    if (period == 0)
+        throw std::invalid_argument("Invalid period");
+
+    for (size_t i = 0; i < RATE_WINDOWS; i++)
+    {
+        unsigned int periods = (WINDOW_SECONDS[i] + period / 2) / period;
+        window_periods[i] = std::min(std::max(periods, 1u), (unsigned int)RATE_RING_PERIODS);
+    }
+
+    for (size_t i = flows.size(); i > 0; i--)
+    {
+        flows[i - 1].next = free_flows;
+        free_flows = (uint32_t)(i - 1);
+    }
+    for (size_t level = 0; level < WHEEL_LEVELS; level++)
+        std::fill(wheel[level], wheel[level] + WHEEL_SLOTS, NO_FLOW);
+    ranking.reserve(max_flows);
+}
+
+/**
+ * @brief Link the flow into the wheel slot of the deadline.
+ *
+ * Deadlines within WHEEL_SLOTS periods go to level 0, later ones to level 1 slot of their
+ * WHEEL_SLOTS-period block. Deadlines beyond level 1 go to its last slot and are rescheduled
+ * when the slot is cascaded.
+ *
+ * @param flow
+ * @param deadline period, not before the current one
+ */
+void FlowStore::link(uint32_t flow, uint32_t deadline)
+{
+    uint32_t *head;
+    if (deadline - now < WHEEL_SLOTS)
+    {
+        head = &wheel[0][deadline & WHEEL_MASK];
+    }
+    else
+    {
+        uint32_t block = std::min(deadline >> WHEEL_BITS, (now >> WHEEL_BITS) + WHEEL_SLOTS - 1);
+        head = &wheel[1][block & WHEEL_MASK];
+    }
+
+    StoredFlow &stored = flows[flow];
+    stored.deadline = deadline;
+    stored.prev = NO_FLOW;
+    stored.next = *head;
+    if (*head != NO_FLOW)
+        flows[*head].prev = flow;
+    *head = flow;
+}
+
+/**
+ * @brief Remove the flow from its wheel slot.
+ *
+ * Only the head of a slot needs the slot itself, level 0 slot is given by the deadline,
+ * level 1 heads are searched because the deadline may be clamped.
+ *
+ * @param flow
+ */
+void FlowStore::unlink(uint32_t flow)
+{
+    StoredFlow &stored = flows[flow];
+    if (stored.prev != NO_FLOW)
+    {
+        flows[stored.prev].next = stored.next;
+    }
+    else if (stored.deadline - now < WHEEL_SLOTS && wheel[0][stored.deadline & WHEEL_MASK] == flow)
+    {
+        wheel[0][stored.deadline & WHEEL_MASK] = stored.next;
+    }
+    else // head of a level 1 slot, clamped deadlines are not in the slot of their block
+    {
+        for (uint32_t &head : wheel[1])
+        {
+            if (head == flow)
+                head = stored.next;
+        }
+    }
+    if (stored.next != NO_FLOW)
+        flows[stored.next].prev = stored.prev;
+}
+
+/**
+ * @brief Forget the flow, which is not linked in the wheel, and return it to the free list.
+ *
+ * @param flow
+ */
+void FlowStore::release(uint32_t flow)
+{
+    index.erase(flows[flow].key);
+    flows[flow].next = free_flows;
+    free_flows = flow;
+}
+
+/**
+ * @brief Evict the first flow of the wheel slot which is scheduled by its last period.
+ *
+ * Flows seen after they were scheduled are rescheduled on the way.
+ *
+ * @param head wheel slot
+ * @return true if a flow was evicted
+ */
+bool FlowStore::evictFrom(uint32_t *head)
+{
+    while (*head != NO_FLOW)
+    {
+        uint32_t flow = *head;
+        unlink(flow);
+        uint32_t deadline = flows[flow].last_seen + idle_periods;
+        if (deadline == flows[flow].deadline)
+        {
+            release(flow);
+            evicted++;
+            return true;
+        }
+        link(flow, deadline);
+    }
+    return false;
+}
+
+/**
+ * @brief Evict the least recently seen flow.
+ *
+ * Wheel slots are visited in the order of deadlines, so the first flow whose deadline is
+ * still given by its last period is the least recently seen one.
+ */
+void FlowStore::evictOne()
+{
+    for (uint32_t i = 0; i < WHEEL_SLOTS; i++)
+    {
+        if (evictFrom(&wheel[0][(now + i) & WHEEL_MASK]))
+            return;
+    }
+    for (uint32_t i = 1; i < WHEEL_SLOTS; i++)
+    {
+        if (evictFrom(&wheel[1][((now >> WHEEL_BITS) + i) & WHEEL_MASK]))
+            return;
+    }
+}
+
+/**
+ * @brief Take a flow from the free list, evict one if the store is full.
+ *
+ * @return uint32_t
+ */
+uint32_t FlowStore::allocate()
+{
+    if (free_flows == NO_FLOW)
+        evictOne();
+
+    uint32_t flow = free_flows;
+    free_flows = flows[flow].next;
+    return flow;
+}
+
+/**
+ * @brief Add statistics of the flow from the current period.
+ *
+ * @param key canonical flow key
+ * @param entry statistics of the period
+ */
+void FlowStore::add(const FlowKey &key, const FlowEntry &entry)
+{
+    uint32_t flow;
+    uint32_t *found = index.find(key);
+    if (found != nullptr)
+    {
+        flow = *found;
+    }
+    else
+    {
+        flow = allocate();
+        index.findOrInsert(key, flow);
+        StoredFlow &stored = flows[flow];
+        stored.key = key;
+        stored.total = FlowStats();
+        stored.reversed = entry.reversed;
+        std::fill(stored.history, stored.history + RATE_RING_PERIODS, 0);
+        std::fill(stored.window_bytes, stored.window_bytes + RATE_WINDOWS, 0);
+        stored.period_bytes = 0;
+        stored.peak_bytes = 0;
+        link(flow, now + idle_periods);
+    }
+
+    StoredFlow &stored = flows[flow];
+    FlowStats stats = entry.stats;
+    if (entry.reversed != stored.reversed) // First packet of the period went the other way
+    {
+        std::swap(stats.rx_bytes, stats.tx_bytes);
+        std::swap(stats.rx_packets, stats.tx_packets);
+    }
+    stored.total.rx_bytes += stats.rx_bytes;
+    stored.total.rx_packets += stats.rx_packets;
+    stored.total.tx_bytes += stats.tx_bytes;
+    stored.total.tx_packets += stats.tx_packets;
+    stored.period_bytes += stats.rx_bytes + stats.tx_bytes;
+    stored.last_seen = now;
+}
+
+/**
+ * @brief Push bytes of the current period to the history of the flow and slide the windows.
+ *
+ * @param flow
+ */
+void FlowStore::pushHistory(StoredFlow &flow)
+{
+    uint32_t bytes = (uint32_t)std::min(flow.period_bytes, (unsigned long long)UINT32_MAX);
+    for (size_t i = 0; i < RATE_WINDOWS; i++)
+    {
+        // Period leaving the window, the ring is zeroed when the flow is created
+        flow.window_bytes[i] += bytes;
+        flow.window_bytes[i] -= flow.history[(now + RATE_RING_PERIODS - window_periods[i]) % RATE_RING_PERIODS];
+    }
+    flow.history[now % RATE_RING_PERIODS] = bytes;
+    flow.peak_bytes = std::max(flow.peak_bytes, flow.period_bytes);
+    flow.period_bytes = 0;
+}
+
+/**
+ * @brief End the current period, expire flows idle for idle_periods periods.
+ *
+ * Flows of the current level 0 slot which were seen after they were scheduled are rescheduled.
+ * When the next period starts a new block, its level 1 slot is cascaded to level 0.
+ */
+void FlowStore::advance()
+{
+    for (size_t i = 0; i < index.usedCount(); i++)
+        pushHistory(flows[index.usedSlot(i).value]);
+
+    uint32_t flow = wheel[0][now & WHEEL_MASK];
+    wheel[0][now & WHEEL_MASK] = NO_FLOW;
+    while (flow != NO_FLOW)
+    {
+        uint32_t next = flows[flow].next;
+        uint32_t deadline = flows[flow].last_seen + idle_periods;
+        if (deadline <= now)
+        {
+            release(flow);
+            expired++;
+        }
+        else
+        {
+            link(flow, deadline);
+        }
+        flow = next;
+    }
+
+    now++;
+    if ((now & WHEEL_MASK) == 0)
+    {
+        flow = wheel[1][(now >> WHEEL_BITS) & WHEEL_MASK];
+        wheel[1][(now >> WHEEL_BITS) & WHEEL_MASK] = NO_FLOW;
+        while (flow != NO_FLOW)
+        {
+            uint32_t next = flows[flow].next;
+            link(flow, flows[flow].deadline);
+            flow = next;
+        }
+    }
+}
+
+/**
+ * @brief Append top stored flows by the cumulative statistics to the snapshot.
+ *
+ * Flows are appended from the most to the least communicating flow like FlowTable::getStatistics.
+ *
+ * @param snapshot
+ * @param sort_key
+ * @param top_flows number of appended flows
+ */
+void FlowStore::getStatistics(HistorySnapshot &snapshot, SortKey sort_key, size_t top_flows)
+{
+    ranking.clear();
+    for (size_t i = 0; i < index.usedCount(); i++)
+        ranking.push_back(index.usedSlot(i).value);
+
+    const std::vector<StoredFlow> &stored = flows;
+    auto ranks_higher = [&stored, sort_key](size_t a, size_t b) {
+        return rankValue(stored[a].total, sort_key) > rankValue(stored[b].total, sort_key);
+    };
+
+    size_t count = std::min(ranking.size(), top_flows);
+    if (count < ranking.size())
+        std::nth_element(ranking.begin(), ranking.begin() + count, ranking.end(), ranks_higher);
+    std::sort(ranking.begin(), ranking.begin() + count, ranks_higher);
+
+    for (size_t i = 0; i < count; i++)
+    {
+        const StoredFlow &flow = flows[ranking[i]];
+        FlowHistory history;
+        history.total = flow.total;
+        for (size_t j = 0; j < RATE_WINDOWS; j++)
+            history.window_rates[j] = flow.window_bytes[j] * 8.0 / ((double)window_periods[j] * period);
+        history.peak_rate = flow.peak_bytes * 8.0 / period;
+        snapshot.push_back({flow.reversed ? flow.key.swapped() : flow.key, history});
+    }
+}
+
+/**
+ * @brief Nominal length of the averaging window, used as the column title.
+ *
+ * @param window index of the window
+ * @return unsigned int seconds
+ */
+unsigned int FlowStore::windowSeconds(size_t window)
+{
+    return WINDOW_SECONDS[window];
+}
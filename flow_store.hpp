@@ -0,0 +1,114 @@
+/**
+ * @file flow_store.hpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Bounded store of flows kept across periods with cumulative statistics.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef FLOW_STORE_HPP
+#define FLOW_STORE_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <utility>
+#include "flow_types.hpp"
+#include "flow_hash_table.hpp"
+
+#define WHEEL_BITS 8
+#define WHEEL_SLOTS (1u << WHEEL_BITS) // slots of one level of the timing wheel
+#define WHEEL_LEVELS 2                 // level 0 counts periods, level 1 counts WHEEL_SLOTS periods
+#define NO_FLOW UINT32_MAX
+
+#define RATE_WINDOWS 3       // averaging windows, 2 s, 10 s and 40 s
+#define RATE_RING_PERIODS 40 // periods of history, the longest window at 1 s period
+
+/**
+ * @brief Flow kept in the store, linked into a timing wheel slot or into the free list.
+ *
+ * History holds bytes of both directions of the last RATE_RING_PERIODS periods,
+ * window sums are updated when a period is pushed, so averages cost nothing to read.
+ */
+struct StoredFlow
+{
+    FlowKey key;        // canonical key
+    FlowStats total;    // counters since the flow was first seen
+    bool reversed;      // as in FlowEntry, direction of the first captured packet
+    uint32_t last_seen; // period the flow was last seen in
+    uint32_t deadline;  // period of the wheel slot the flow is linked in
+    uint32_t next;
+    uint32_t prev;
+    uint32_t history[RATE_RING_PERIODS]; // bytes per period, saturated, indexed by period
+    unsigned long long window_bytes[RATE_WINDOWS];
+    unsigned long long period_bytes; // bytes of the current period
+    unsigned long long peak_bytes;   // bytes of the busiest period
+};
+
+/**
+ * @brief Statistics of a stored flow for the display.
+ *
+ */
+struct FlowHistory
+{
+    FlowStats total;
+    double window_rates[RATE_WINDOWS]; // b/s averaged over the windows
+    double peak_rate;                  // b/s of the busiest period
+};
+
+/**
+ * @brief Top stored flows, reused in every period like FlowSnapshot.
+ *
+ */
+typedef std::vector<std::pair<FlowKey, FlowHistory>> HistorySnapshot;
+
+/**
+ * @brief Flows accumulated across periods, memory is bounded by the maximal number of flows.
+ *
+ * Statistics of each period are added to the stored flows, so flows keep their identity and
+ * cumulative totals. Flows not seen for the idle timeout expire through a hierarchical timing
+ * wheel with period ticks. Flows are not moved in the wheel when they are seen, an expiring flow
+ * which was seen in the meantime is only rescheduled, so the wheel costs amortized O(1) per flow
+ * and period. Each flow also keeps a ring of per-period byte counts from which the 2 s, 10 s
+ * and 40 s averages are maintained, like in iftop. When the store is full, the least recently
+ * seen flow is evicted to make room, flows with idle timeout beyond WHEEL_SLOTS periods are
+ * ordered only by their WHEEL_SLOTS-period block.
+ *
+ * Not thread-safe, used by the reader only.
+ */
+class FlowStore
+{
+private:
+    FlowHashTable<FlowKey, uint32_t, FlowKeyHash> index; // flow key -> flow
+    std::vector<StoredFlow> flows; // all flows allocated at construction
+    std::vector<size_t> ranking;   // Scratch space for selecting the top flows
+    uint32_t free_flows;           // head of the free list
+    uint32_t wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+    uint32_t now;                  // current period
+    uint32_t idle_periods;
+    unsigned int period;                        // s
+    uint32_t window_periods[RATE_WINDOWS];      // window lengths in periods
+    unsigned long long expired;
+    unsigned long long evicted;
+
+    void link(uint32_t flow, uint32_t deadline);
+    void unlink(uint32_t flow);
+    void release(uint32_t flow);
+    uint32_t allocate();
+    bool evictFrom(uint32_t *head);
+    void evictOne();
+    void pushHistory(StoredFlow &flow);
+
+public:
+    FlowStore(size_t max_flows, unsigned int idle_periods, unsigned int period);
+    void add(const FlowKey &key, const FlowEntry &entry);
+    void advance();
+    void getStatistics(HistorySnapshot &snapshot, SortKey sort_key, size_t top_flows);
+    static unsigned int windowSeconds(size_t window);
+    size_t size() const { return index.usedCount(); }
+    unsigned long long expiredCount() const { return expired; }
+    unsigned long long evictedCount() const { return evicted; }
+};
+
+#endif
@@ -8,143 +8,335 @@
  */
 
 #include "flow_table.hpp"
+#include "flow_store.hpp"
+#include "flow_sketch.hpp"
 #include <string>
-#include <unordered_map>
-#include <list>
 #include <stdexcept>
 #include <cstdint>
+#include <cstring>
 #include <iostream>
+#include <vector>
+#include <algorithm>
+#include <thread>
+#include <chrono>
 
 /**
- * @brief Update existing record with key in top ten flow list or insert new, then sort.
+ * @brief Construct a new Flow Table object
  * 
+ * All memory for the flow records is allocated here.
+ * 
+ * @param max_flows maximal number of flows tracked within one period
+ */
+FlowTable::FlowTable(size_t max_flows) : FlowTable(max_flows, 0) {}
+
+/**
+ * @brief Construct a new Flow Table object recording into sketches if sketch_counters is not zero.
+ * 
+ * @param max_flows maximal number of flows tracked within one period in exact mode
+ * @param sketch_counters number of flows monitored by each sketch, 0 for exact mode
+ */
+FlowTable::FlowTable(size_t max_flows, size_t sketch_counters)
+    : generations{FlowGeneration(sketch_counters > 0 ? 1 : max_flows), FlowGeneration(sketch_counters > 0 ? 1 : max_flows)},
+      active(&generations[0]), in_use(nullptr), sort_key(SortKey::BYTES), top_flows(10)
+{
+    if (sketch_counters > 0)
+    {
+        sketches[0].reset(new FlowSketch(sketch_counters));
+        sketches[1].reset(new FlowSketch(sketch_counters));
+    }
+    else
+    {
+        ranking.reserve(max_flows);
+    }
+}
+
+FlowTable::~FlowTable() {}
+
+/**
+ * @brief Sketch paired with the generation.
+ * 
+ * @param generation 
+ * @return FlowSketch* nullptr in exact mode
+ */
+FlowSketch *FlowTable::_sketchOf(FlowGeneration *generation)
+{
+    return sketches[generation - &generations[0]].get();
+}
+
+/**
+ * @brief Update existing record with key in the generation or insert new.
+ * 
+ * Key is normalized to its canonical direction, so both directions of the flow
+ * are resolved by a single table lookup. Only counters are updated, flows are
+ * ranked when the statistics are collected.
+ * 
+ * @param generation generation the record is updated in
  * @param key flow identification (src:port, dst:port, protocol)
  * @param bytes number of transferred bytes
  */
-void FlowTable::_addOrUpdateRecord(FlowKey key, uint32_t bytes)
+void FlowTable::_addOrUpdateRecord(FlowGeneration &generation, FlowKey key, uint32_t bytes)
 {
-    // Try direction 1
-    auto it = table.find(key);
-    if (it != table.end())
-    {
-        it->second.tx_bytes += bytes;
-        it->second.tx_packets += 1;
-        updateTopTenWith(it->first, it->second);
+    bool reversed = key.canonicalize();
+
+    // Inserts new record with the direction of the first packet or finds the existing one
+    _addOrUpdateEntry(generation.findOrInsert(key, FlowEntry(reversed)), reversed, bytes);
+}
+
+/**
+ * @brief Account the packet to the counters of its direction.
+ * 
+ * @param entry record of the flow, nullptr if the table is full
+ * @param reversed packet direction is opposite to the canonical key
+ * @param bytes number of transferred bytes
+ */
+void FlowTable::_addOrUpdateEntry(FlowEntry *entry, bool reversed, uint32_t bytes)
+{
+    if (entry == nullptr) // Table is full, flow is not accounted until the next period
         return;
-    }
+    entry->account(reversed, bytes);
+}
+
+/**
+ * @brief Append top communication flows of the generation to the snapshot.
+ * 
+ * Top flows are selected from the whole generation in linear time and only they are sorted,
+ * they are appended from the most to the least communicating flow.
+ * 
+ * @param flows generation which is not updated by the capture thread
+ * @param snapshot 
+ */
+void FlowTable::_getStatistics(const FlowGeneration &flows, FlowSnapshot &snapshot)
+{
+    ranking.clear();
+    for (size_t i = 0; i < flows.usedCount(); i++)
+        ranking.push_back(i);
+
+    SortKey key = sort_key;
+    auto ranks_higher = [&flows, key](size_t a, size_t b) {
+        return rankValue(flows.usedSlot(a).value.stats, key) > rankValue(flows.usedSlot(b).value.stats, key);
+    };
 
-    // Try direction 2
-    FlowKey swapped_directions(key.dst_address, key.dst_port, key.src_address, key.src_port, key.protocol, key.ip);
-    it = table.find(swapped_directions);
-    if (it != table.end())
+    size_t count = std::min(ranking.size(), top_flows);
+    if (count < ranking.size())
+        std::nth_element(ranking.begin(), ranking.begin() + count, ranking.end(), ranks_higher);
+    std::sort(ranking.begin(), ranking.begin() + count, ranks_higher);
+
+    for (size_t i = 0; i < count; i++)
     {
-        it->second.rx_bytes += bytes;
-        it->second.rx_packets += 1;
-        updateTopTenWith(it->first, it->second);
-        return;
+        const FlowGeneration::Slot &slot = flows.usedSlot(ranking[i]);
+        snapshot.push_back({slot.value.reversed ? slot.key.swapped() : slot.key, slot.value.stats});
     }
+}
 
-    // Key not present in the table
-    FlowStats new_record(0, 0, bytes, 1);
-    table[key] = new_record;
-    updateTopTenWith(key, new_record);
+// Public methods
+/**
+ * @brief Announce the active generation in in_use and return it.
+ * 
+ * If the reader retired the generation in the meantime, the update moves to the new
+ * active generation, so the capture thread never waits. Caller clears in_use when done.
+ * 
+ * @return FlowGeneration* 
+ */
+FlowGeneration *FlowTable::_acquireActive()
+{
+    FlowGeneration *generation = active.load(std::memory_order_acquire);
+    while (true)
+    {
+        in_use.store(generation, std::memory_order_seq_cst);
+        FlowGeneration *current = active.load(std::memory_order_seq_cst);
+        if (current == generation)
+            return generation;
+        generation = current;
+    }
 }
 
 /**
- * @brief Return list of top ten communication flows.
+ * @brief _addOrUpdateRecord on the active generation, called only by the capture thread.
  * 
- * @return std::list<std::pair<FlowKey, FlowStats>> 
+ * @param key 
+ * @param bytes 
  */
-std::list<std::pair<FlowKey, FlowStats>> FlowTable::_getStatistics()
+void FlowTable::addOrUpdateRecord(FlowKey key, uint32_t bytes)
 {
-    return top_ten_records;
+    FlowGeneration *generation = _acquireActive();
+    FlowSketch *sketch = _sketchOf(generation);
+    if (sketch != nullptr)
+    {
+        bool reversed = key.canonicalize();
+        sketch->add(key, reversed, bytes, sort_key);
+    }
+    else
+    {
+        _addOrUpdateRecord(*generation, key, bytes);
+    }
+    in_use.store(nullptr, std::memory_order_release);
 }
 
 /**
- * @brief Update list of top ten communication flows.
+ * @brief Update records of a batch of packets, called only by the capture thread.
  * 
- * @param key   (src:port, dst:port, protocol)
- * @param value update number of bytes fore the flow
+ * Generation is announced once for the whole batch. Keys of each chunk are canonicalized
+ * and hashed and their slots prefetched first, so the cache misses of the lookups overlap.
+ * 
+ * @param records packets to account, keys are canonicalized in place
+ * @param count number of records
  */
-void FlowTable::updateTopTenWith(FlowKey key,
-                                                 FlowStats value)
+void FlowTable::addOrUpdateBatch(FlowRecord *records, size_t count)
 {
-    // Update the value if present
-    bool present = false;
-    for (auto it = top_ten_records.begin(); it != top_ten_records.end(); it++)
+    size_t hashes[FLOW_BATCH_SIZE];
+    bool reversed[FLOW_BATCH_SIZE];
+
+    FlowGeneration *generation = _acquireActive();
+    FlowSketch *sketch = _sketchOf(generation);
+    if (sketch != nullptr)
     {
-        if (it->first == key)
+        for (size_t i = 0; i < count; i++)
         {
-            it->second = value;
-            present = true;
-            break;
+            bool packet_reversed = records[i].key.canonicalize();
+            sketch->add(records[i].key, packet_reversed, records[i].bytes, sort_key);
         }
+        in_use.store(nullptr, std::memory_order_release);
+        return;
     }
 
-    // Push new if not present    
-    if (!present)
+    for (size_t first = 0; first < count; first += FLOW_BATCH_SIZE)
     {
-        top_ten_records.push_front({key, value});
+        size_t chunk = std::min(count - first, (size_t)FLOW_BATCH_SIZE);
+        FlowRecord *chunk_records = records + first;
+
+        for (size_t i = 0; i < chunk; i++)
+        {
+            reversed[i] = chunk_records[i].key.canonicalize();
+            hashes[i] = generation->hashOf(chunk_records[i].key);
+            generation->prefetch(hashes[i]);
+        }
+
+        for (size_t i = 0; i < chunk; i++)
+        {
+            FlowEntry *entry = generation->findOrInsert(chunk_records[i].key, hashes[i], FlowEntry(reversed[i]));
+            _addOrUpdateEntry(entry, reversed[i], chunk_records[i].bytes);
+        }
     }
+    in_use.store(nullptr, std::memory_order_release);
+}
+
+/**
+ * @brief Flip generations and wait until the capture thread leaves the retired one.
+ * 
+ * Waits only for the update the capture thread may have in flight on the retired
+ * generation, the capture continues in the other one. Caller holds the lock.
+ * Work of the retired generation is added to the counters.
+ * 
+ * @param begin time the reader started to wait for the lock
+ * @return FlowGeneration* 
+ */
+FlowGeneration *FlowTable::_retireActive(std::chrono::steady_clock::time_point begin)
+{
+    FlowGeneration *retired = active.load(std::memory_order_relaxed);
+    FlowGeneration *next = retired == &generations[0] ? &generations[1] : &generations[0];
+    active.store(next, std::memory_order_seq_cst);
+
+    while (in_use.load(std::memory_order_seq_cst) == retired)
+        std::this_thread::yield();
+
+    counters.inserted += retired->usedCount();
+    counters.rejected += retired->rejected();
+    counters.retire_wait_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - begin).count();
+    return retired;
+}
 
-    // Order the list
-    if (sort_key == SortKey::BYTES){
-        top_ten_records.sort([](const std::pair<FlowKey, FlowStats> &a,
-                                const std::pair<FlowKey, FlowStats> &b) {
-                                    return std::max(a.second.rx_bytes, a.second.tx_bytes) < std::max(b.second.rx_bytes, b.second.tx_bytes);
-        });
-    } else { // PACKETS
-        top_ten_records.sort([](const std::pair<FlowKey, FlowStats> &a,
-                                const std::pair<FlowKey, FlowStats> &b) {
-                                    return std::max(a.second.rx_packets, a.second.tx_packets) < std::max(b.second.rx_packets, b.second.tx_packets);
-        });
+/**
+ * @brief Flip generations and append top flows of the retired one to the snapshot.
+ * 
+ * @param snapshot 
+ */
+void FlowTable::getStatistics(FlowSnapshot &snapshot)
+{
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(m);
+    FlowGeneration *retired = _retireActive(begin);
+    FlowSketch *sketch = _sketchOf(retired);
+    if (sketch != nullptr)
+    {
+        sketch->getStatistics(snapshot, sort_key, top_flows);
+        sketch->reset();
+        return;
     }
 
-    // Pop last elem if size exceeds 10
-    if (top_ten_records.size() > 10)
+    _getStatistics(*retired, snapshot);
+    retired->reset();
+}
+
+/**
+ * @brief Flip generations and add all flows of the retired one to the store.
+ * 
+ * @param store flows kept across periods
+ */
+void FlowTable::collectStatistics(FlowStore &store)
+{
+    std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+    std::lock_guard<std::mutex> lock(m);
+    FlowGeneration *retired = _retireActive(begin);
+    FlowSketch *sketch = _sketchOf(retired);
+    if (sketch != nullptr)
+    {
+        for (size_t i = 0; i < sketch->size(); i++)
+            store.add(sketch->counter(i).key, sketch->counter(i).entry);
+        sketch->reset();
+        return;
+    }
+
+    for (size_t i = 0; i < retired->usedCount(); i++)
     {
-        top_ten_records.pop_front();
+        const FlowGeneration::Slot &slot = retired->usedSlot(i);
+        store.add(slot.key, slot.value);
     }
+    retired->reset();
 }
 
 /**
- * @brief Clear table and top ten record structures.
+ * @brief Keep only the top flows of a snapshot the statistics of several tables were appended to.
+ * 
+ * Tables must not share flows, which holds for tables fed by flow-hashed capture sockets.
  * 
+ * @param snapshot results of getStatistics of the tables, updated in place
  */
-void FlowTable::clear()
+void FlowTable::mergeStatistics(FlowSnapshot &snapshot)
 {
-    table.clear();
-    top_ten_records.clear();
+    SortKey key = sort_key;
+    auto ranks_higher = [key](const std::pair<FlowKey, FlowStats> &a, const std::pair<FlowKey, FlowStats> &b) {
+        return rankValue(a.second, key) > rankValue(b.second, key);
+    };
+
+    size_t count = std::min(snapshot.size(), top_flows);
+    std::partial_sort(snapshot.begin(), snapshot.begin() + count, snapshot.end(), ranks_higher);
+    snapshot.erase(snapshot.begin() + count, snapshot.end());
 }
 
-// Public methods
 /**
- * @brief _addOrUpdateRecord with lock
+ * @brief Work of the table since the start, up to the last retired generation.
  * 
- * @param key 
- * @param bytes 
+ * @return FlowTableCounters 
  */
-void FlowTable::addOrUpdateRecord(FlowKey key, uint32_t bytes)
+FlowTableCounters FlowTable::getCounters()
 {
     std::lock_guard<std::mutex> lock(m);
-    return _addOrUpdateRecord(key, bytes);
+    return counters;
 }
 
 /**
- * @brief _getStatistics with lock
+ * @brief Number of top flows returned by getStatistics
  * 
- * @return std::list<std::pair<FlowKey, FlowStats>> 
+ * @param count 
  */
-std::list<std::pair<FlowKey, FlowStats>> FlowTable::getStatistics()
+void FlowTable::setTopFlows(size_t count)
 {
-    std::lock_guard<std::mutex> lock(m);
-    std::list<std::pair<FlowKey, FlowStats>> stats = _getStatistics();
-    clear();
-    return stats;
+    top_flows = count;
 }
 
 /**
- * @brief Sort key for sorting the records in the top ten table
+ * @brief Sort key for sorting the records in the top flows table
  * 
  * @param key 
  */
@@ -11,116 +11,91 @@
 #define TST_HPP
 
 #include <string>
-#include <unordered_map>
-#include <list>
+#include <vector>
 #include <cstdint>
 #include <mutex>
+#include <atomic>
+#include <chrono>
 #include <memory>
+#include "flow_types.hpp"
+#include "flow_hash_table.hpp"
 
-enum class IpAddrClass {
-    IPV4 = 0,
-    IPV6 = 1
-};
-
-enum class SortKey
-{
-    BYTES,
-    PACKETS
-};
-
-/**
- * @brief Key uniquely identifying a flow - src_address, src_port, dst_address, dst_port, protocol
- * 
- */
-struct FlowKey
-{
-    FlowKey(std::string src_address_,
-                         uint16_t src_port_,
-                         std::string dst_address_,
-                         uint16_t dst_port_,
-                         std::string protocol_,
-                         IpAddrClass ip_) : src_address(src_address_),
-                                                  src_port(src_port_),
-                                                  dst_address(dst_address_),
-                                                  dst_port(dst_port_),
-                                                  protocol(protocol_),
-                                                  ip(ip_) {}
-    bool operator==(const FlowKey &rhs) const
-    {
-        return std::tie(    src_address,     src_port,     dst_address,     dst_port,     protocol) ==
-               std::tie(rhs.src_address, rhs.src_port, rhs.dst_address, rhs.dst_port, rhs.protocol);
-    }
+#define FLOW_BATCH_SIZE 64 // records applied to the table at once
 
-    std::string src_address;
-    uint16_t src_port;
-    std::string dst_address;
-    uint16_t dst_port;
-    std::string protocol;
-    IpAddrClass ip;
-};
-
-
-template <>
-struct std::hash<FlowKey>
-{
-    std::size_t operator()(const FlowKey &val) const
-    {
-        return (1 << std::hash<int>{}(val.src_port)) ^
-               (3 << std::hash<int>{}(val.dst_port)) ^
-               (5 << std::hash<std::string>{}(val.src_address)) ^
-               (7 << std::hash<std::string>{}(val.dst_address)) ^
-               (9 << std::hash<std::string>{}(val.protocol));
-    }
-};
+typedef FlowHashTable<FlowKey, FlowEntry, FlowKeyHash> FlowGeneration;
 
 /**
- * @brief 
+ * @brief Work of the table since the start, counted when the generations are retired.
  * 
  */
-struct FlowStats
+struct FlowTableCounters
 {
-    FlowStats() : rx_bytes(0), rx_packets(0), tx_bytes(0), tx_packets(0) {}
-    FlowStats(unsigned long long rx_bytes_,
-                           unsigned long long rx_packets_,
-                           unsigned long long tx_bytes_,
-                           unsigned long long tx_packets_) : rx_bytes(rx_bytes_), rx_packets(rx_packets_), tx_bytes(tx_bytes_), tx_packets(tx_packets_) {}
-    unsigned long long rx_bytes;
-    unsigned long long rx_packets;
-    unsigned long long tx_bytes;
-    unsigned long long tx_packets;
+    FlowTableCounters() : inserted(0), rejected(0), retire_wait_ns(0) {}
+    unsigned long long inserted;       // flows inserted into the generations, not counted in sketch mode
+    unsigned long long rejected;       // packets of flows not inserted because the generation was full
+    unsigned long long retire_wait_ns; // time the reader waited for the lock and for the capture thread
 };
 
+class FlowStore;
+class FlowSketch;
 
 /**
  * @brief Table for storing statistics about captured flows.
  * 
- * Manages list of top ten communication flows based on provided sort key.
- * Thread-safe, table or top ten list access uses locks.
+ * Provides list of top communication flows based on provided sort key,
+ * flows are ranked only when the statistics are collected.
+ * 
+ * Flows are recorded into one of two generations. At the period boundary the reader
+ * flips the active generation and ranks and resets the retired one, so the capture
+ * thread never waits for the reader. Records may be added by a single capture thread,
+ * statistics may be collected by any number of threads (readers use locks).
+ * 
+ * In sketch mode each generation is paired with a FlowSketch which records the flows
+ * in fixed memory instead, the generation only marks which sketch is active.
  * 
  */
 class FlowTable
 {
 private:
-    // Access Control
+    // Access Control of the readers
     std::mutex m;
     
-    std::unordered_map<FlowKey, FlowStats> table;
-    std::list<std::pair<FlowKey, FlowStats>> top_ten_records;
+    FlowGeneration generations[2];
+    std::atomic<FlowGeneration *> active; // Generation the capture thread records into
+    std::atomic<FlowGeneration *> in_use; // Generation the capture thread is updating right now
+    std::vector<size_t> ranking; // Scratch space for selecting the top flows
+    std::unique_ptr<FlowSketch> sketches[2]; // Used instead of the generations in sketch mode
     SortKey sort_key;
+    size_t top_flows;
+    FlowTableCounters counters; // updated by the readers under the lock
 
     // If exists, update count, else create new record
-    // Place to the right pos in th array of the top [10] or update existing
-    void updateTopTenWith(FlowKey key, FlowStats value);
-    void clear();
-    void _addOrUpdateRecord(FlowKey key, uint32_t value);
+    void _addOrUpdateRecord(FlowGeneration &generation, FlowKey key, uint32_t value);
+    void _addOrUpdateEntry(FlowEntry *entry, bool reversed, uint32_t value);
+
+    // Announce the generation the capture thread is going to update
+    FlowGeneration *_acquireActive();
+    // Flip generations, return the retired one once the capture thread left it
+    FlowGeneration *_retireActive(std::chrono::steady_clock::time_point begin);
     
-    // Top 10 ordered by given key
-    std::list<std::pair<FlowKey, FlowStats>> _getStatistics();
+    // Sketch recorded together with the generation, nullptr in exact mode
+    FlowSketch *_sketchOf(FlowGeneration *generation);
+
+    // Append top flows of the generation ordered by given key
+    void _getStatistics(const FlowGeneration &generation, FlowSnapshot &snapshot);
     
 public:
+    explicit FlowTable(size_t max_flows);
+    FlowTable(size_t max_flows, size_t sketch_counters);
+    ~FlowTable();
     void setSortKey(SortKey key);
+    void setTopFlows(size_t count);
     void addOrUpdateRecord(FlowKey key, uint32_t value);
-    std::list<std::pair<FlowKey, FlowStats>> getStatistics();
+    void addOrUpdateBatch(FlowRecord *records, size_t count);
+    void getStatistics(FlowSnapshot &snapshot);
+    void collectStatistics(FlowStore &store);
+    void mergeStatistics(FlowSnapshot &snapshot);
+    FlowTableCounters getCounters();
 };
 
 #endif
\ No newline at end of file
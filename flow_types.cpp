@@ -0,0 +1,113 @@
+/**
+ * @file flow_types.cpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Seeded hash of the flow keys and text formatting of the flows.
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#include "flow_types.hpp"
+
+#include <arpa/inet.h>
+
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <random>
+
+/**
+ * @brief Process-wide hash seed, drawn once at startup.
+ * 
+ * @return uint64_t 
+ */
+static uint64_t startupHashSeed()
+{
+    static const uint64_t seed = []() {
+        std::random_device rd;
+        return ((uint64_t)rd() << 32) ^ rd();
+    }();
+    return seed;
+}
+
+/**
+ * @brief Fold 64-bit word into the hash state (multiply-xorshift).
+ * 
+ * @param h hash state
+ * @param word 
+ * @return uint64_t 
+ */
+static inline uint64_t hashMix(uint64_t h, uint64_t word)
+{
+    h ^= word;
+    h *= 0x9e3779b97f4a7c15ULL;
+    return h ^ (h >> 32);
+}
+
+/**
+ * @brief Final avalanche so that low bits used for bucket selection depend on every input bit.
+ * 
+ * @param h hash state
+ * @return uint64_t 
+ */
+static inline uint64_t hashFinalize(uint64_t h)
+{
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    return h ^ (h >> 33);
+}
+
+FlowKeyHash::FlowKeyHash() : seed(startupHashSeed()) {}
+
+/**
+ * @brief Hash the 5-tuple and address class.
+ * 
+ * @param key 
+ * @return std::size_t 
+ */
+std::size_t FlowKeyHash::operator()(const FlowKey &key) const
+{
+    uint64_t words[4];
+    memcpy(words, key.src_address.bytes, sizeof(key.src_address.bytes));
+    memcpy(words + 2, key.dst_address.bytes, sizeof(key.dst_address.bytes));
+
+    uint64_t h = seed;
+    h = hashMix(h, words[0]);
+    h = hashMix(h, words[1]);
+    h = hashMix(h, words[2]);
+    h = hashMix(h, words[3]);
+    h = hashMix(h, ((uint64_t)key.src_port << 32) | ((uint64_t)key.dst_port << 16) |
+                   ((uint64_t)key.protocol << 8) | (uint64_t)key.ip);
+    return hashFinalize(h);
+}
+
+/**
+ * @brief Format both addresses of the flow key.
+ * 
+ * @param key 
+ */
+FlowKeyText::FlowKeyText(const FlowKey &key)
+{
+    int family = key.ip == IpAddrClass::IPV4 ? AF_INET : AF_INET6;
+    inet_ntop(family, key.src_address.bytes, src, sizeof(src));
+    inet_ntop(family, key.dst_address.bytes, dst, sizeof(dst));
+}
+
+/**
+ * @brief Append formatted text to the string.
+ * 
+ * Formatted text must be shorter than FORMAT_RECORD_SIZE, longer text is truncated.
+ * 
+ * @param text 
+ * @param fmt printf format
+ * @param args arguments of the format
+ */
+void appendFormat(std::string &text, const char *fmt, va_list args)
+{
+    char record[FORMAT_RECORD_SIZE];
+    int length = vsnprintf(record, sizeof(record), fmt, args);
+    if (length > 0)
+        text.append(record, std::min((size_t)length, sizeof(record) - 1));
+}
@@ -0,0 +1,228 @@
+/**
+ * @file flow_types.hpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Flow keys, statistics and records shared by the flow table, store and sketch.
+ * 
+ * @copyright Copyright (c) 2024
+ * 
+ */
+
+#ifndef FLOW_TYPES_HPP
+#define FLOW_TYPES_HPP
+
+#include <netinet/in.h>
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstdarg>
+#include <cstddef>
+#include <cstring>
+#include <tuple>
+#include <utility>
+#include <algorithm>
+
+#define FORMAT_RECORD_SIZE 512 // longest record formatted by appendFormat
+
+enum class IpAddrClass : uint8_t {
+    IPV4 = 0,
+    IPV6 = 1
+};
+
+enum class SortKey
+{
+    BYTES,
+    PACKETS
+};
+
+/**
+ * @brief Raw IPv4 or IPv6 address in network byte order.
+ *
+ * IPv4 addresses occupy the first four bytes, the rest is zeroed.
+ */
+union IpAddress
+{
+    uint8_t bytes[16];
+    uint32_t words[4];
+};
+
+/**
+ * @brief Key uniquely identifying a flow - src_address, src_port, dst_address, dst_port, protocol
+ * 
+ * Fixed-size POD, addresses are kept in binary form and converted to text only when displayed.
+ */
+struct FlowKey
+{
+    FlowKey() : src_address(), dst_address(), src_port(0), dst_port(0), protocol(0), ip(IpAddrClass::IPV4) {}
+    FlowKey(const IpAddress &src_address_,
+            uint16_t src_port_,
+            const IpAddress &dst_address_,
+            uint16_t dst_port_,
+            uint8_t protocol_,
+            IpAddrClass ip_) : src_address(src_address_),
+                               dst_address(dst_address_),
+                               src_port(src_port_),
+                               dst_port(dst_port_),
+                               protocol(protocol_),
+                               ip(ip_) {}
+    bool operator==(const FlowKey &rhs) const
+    {
+        return memcmp(src_address.bytes, rhs.src_address.bytes, sizeof(src_address.bytes)) == 0 &&
+               memcmp(dst_address.bytes, rhs.dst_address.bytes, sizeof(dst_address.bytes)) == 0 &&
+               std::tie(    src_port,     dst_port,     protocol,     ip) ==
+               std::tie(rhs.src_port, rhs.dst_port, rhs.protocol, rhs.ip);
+    }
+
+    /**
+     * @brief Key of the opposite direction of the flow.
+     * 
+     * @return FlowKey 
+     */
+    FlowKey swapped() const
+    {
+        return FlowKey(dst_address, dst_port, src_address, src_port, protocol, ip);
+    }
+
+    /**
+     * @brief Order the endpoints so that the lower (address, port) endpoint is the source.
+     * 
+     * Both directions of a flow map onto the same canonical key.
+     * 
+     * @return true if the endpoints were swapped
+     */
+    bool canonicalize()
+    {
+        int cmp = memcmp(src_address.bytes, dst_address.bytes, sizeof(src_address.bytes));
+        if (cmp > 0 || (cmp == 0 && src_port > dst_port))
+        {
+            std::swap(src_address, dst_address);
+            std::swap(src_port, dst_port);
+            return true;
+        }
+        return false;
+    }
+
+    IpAddress src_address;
+    IpAddress dst_address;
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint8_t protocol;   // IANA protocol number
+    IpAddrClass ip;
+};
+
+
+/**
+ * @brief Seeded multiply-xorshift hash of the packed flow key.
+ * 
+ * Default constructed hashers share a seed randomized at startup, so bucket
+ * placement cannot be predicted by crafted traffic.
+ */
+struct FlowKeyHash
+{
+    FlowKeyHash();
+    explicit FlowKeyHash(uint64_t seed_) : seed(seed_) {}
+    std::size_t operator()(const FlowKey &key) const;
+
+    uint64_t seed;
+};
+
+/**
+ * @brief 
+ * 
+ */
+struct FlowStats
+{
+    FlowStats() : rx_bytes(0), rx_packets(0), tx_bytes(0), tx_packets(0) {}
+    FlowStats(unsigned long long rx_bytes_,
+                           unsigned long long rx_packets_,
+                           unsigned long long tx_bytes_,
+                           unsigned long long tx_packets_) : rx_bytes(rx_bytes_), rx_packets(rx_packets_), tx_bytes(tx_bytes_), tx_packets(tx_packets_) {}
+    unsigned long long rx_bytes;
+    unsigned long long rx_packets;
+    unsigned long long tx_bytes;
+    unsigned long long tx_packets;
+};
+
+/**
+ * @brief Flow statistics stored under the canonical flow key.
+ * 
+ * Tx counters belong to the direction of the first captured packet of the flow,
+ * reversed is set if that direction is opposite to the canonical key.
+ */
+struct FlowEntry
+{
+    FlowEntry() : stats(), reversed(false) {}
+    FlowEntry(bool reversed_) : stats(), reversed(reversed_) {}
+
+    /**
+     * @brief Account the packet to the counters of its direction.
+     * 
+     * @param packet_reversed packet direction is opposite to the canonical key
+     * @param bytes number of transferred bytes
+     */
+    void account(bool packet_reversed, uint32_t bytes)
+    {
+        if (reversed == packet_reversed) // Direction of the first packet
+        {
+            stats.tx_bytes += bytes;
+            stats.tx_packets += 1;
+        }
+        else // Opposite direction
+        {
+            stats.rx_bytes += bytes;
+            stats.rx_packets += 1;
+        }
+    }
+
+    FlowStats stats;
+    bool reversed;
+};
+
+
+/**
+ * @brief Flow of one captured packet and its length, queued for batched update of the table.
+ * 
+ */
+struct FlowRecord
+{
+    FlowKey key;
+    uint32_t bytes;
+};
+
+/**
+ * @brief Top flows of a period, ordered from the most to the least communicating flow.
+ * 
+ * Snapshots are filled in place and reused in every period. Clearing keeps the capacity,
+ * so all records of the period are released at once and no memory is allocated once
+ * the snapshot has grown to the number of displayed flows.
+ */
+typedef std::vector<std::pair<FlowKey, FlowStats>> FlowSnapshot;
+
+/**
+ * @brief Value the flows are ranked by.
+ * 
+ * @param stats 
+ * @param sort_key 
+ * @return unsigned long long 
+ */
+inline unsigned long long rankValue(const FlowStats &stats, SortKey sort_key)
+{
+    if (sort_key == SortKey::BYTES)
+        return std::max(stats.rx_bytes, stats.tx_bytes);
+    return std::max(stats.rx_packets, stats.tx_packets); // PACKETS
+}
+
+/**
+ * @brief Source and destination addresses of the flow as text, in the direction of the key.
+ * 
+ */
+struct FlowKeyText
+{
+    explicit FlowKeyText(const FlowKey &key);
+    char src[INET6_ADDRSTRLEN];
+    char dst[INET6_ADDRSTRLEN];
+};
+
+void appendFormat(std::string &text, const char *fmt, va_list args);
+
+#endif
@@ -0,0 +1,156 @@
+/**
+ * @file flow_writer.cpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Headless output of the top flows as JSON Lines or CSV records.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "flow_writer.hpp"
+
+#include <cstdarg>
+
+/**
+ * @brief Start the export writer with the CSV header of the records.
+ *
+ * Records are appended to an existing file, CSV header is written only at the start of a file.
+ *
+ * @param format JSONL or CSV
+ * @param cumulative records of flows kept across periods, written by writeHistory
+ * @param path output file, nullptr for stdout
+ * @param options rotation and fsync of the output file
+ */
+FlowWriter::FlowWriter(OutputFormat format, bool cumulative, const char *path, const ExportOptions &options)
+    : format(format), text(nullptr), writer(path != nullptr ? path : "", false, options, header(format, cumulative))
+{
+}
+
+/**
+ * @brief CSV header line, empty for JSON Lines.
+ *
+ * @param format
+ * @param cumulative header of writeHistory records
+ * @return std::string
+ */
+std::string FlowWriter::header(OutputFormat format, bool cumulative)
+{
+    if (format != OutputFormat::CSV)
+        return "";
+    if (!cumulative)
+        return "time_ms,period,rank,src,src_port,dst,dst_port,protocol,rx_bytes,rx_packets,tx_bytes,tx_packets\n";
+
+    std::string line = "time_ms,rank,src,src_port,dst,dst_port,protocol,rx_bytes,rx_packets,tx_bytes,tx_packets";
+    for (size_t i = 0; i < RATE_WINDOWS; i++)
+        line += ",rate_" + std::to_string(FlowStore::windowSeconds(i)) + "s";
+    return line + ",peak_rate\n";
+}
+
+/**
+ * @brief Append formatted text to the buffer of the period.
+ *
+ * Formatted text must be shorter than FORMAT_RECORD_SIZE.
+ *
+ * @param fmt printf format
+ */
+void FlowWriter::append(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    appendFormat(*text, fmt, args);
+    va_end(args);
+}
+
+/**
+ * @brief Append addresses, ports and protocol number of the flow.
+ *
+ * @param key flow key in the direction of the first packet
+ */
+void FlowWriter::appendKey(const FlowKey &key)
+{
+    FlowKeyText addresses(key);
+    if (format == OutputFormat::JSONL)
+        append("\"src\":\"%s\",\"src_port\":%u,\"dst\":\"%s\",\"dst_port\":%u,\"protocol\":%u",
+               addresses.src, (unsigned int)key.src_port, addresses.dst, (unsigned int)key.dst_port,
+               (unsigned int)key.protocol);
+    else
+        append("%s,%u,%s,%u,%u", addresses.src, (unsigned int)key.src_port, addresses.dst,
+               (unsigned int)key.dst_port, (unsigned int)key.protocol);
+}
+
+/**
+ * @brief Append octet and packet counters of both directions.
+ *
+ * @param stats
+ */
+void FlowWriter::appendStats(const FlowStats &stats)
+{
+    if (format == OutputFormat::JSONL)
+        append(",\"rx_bytes\":%llu,\"rx_packets\":%llu,\"tx_bytes\":%llu,\"tx_packets\":%llu",
+               stats.rx_bytes, stats.rx_packets, stats.tx_bytes, stats.tx_packets);
+    else
+        append(",%llu,%llu,%llu,%llu", stats.rx_bytes, stats.rx_packets, stats.tx_bytes, stats.tx_packets);
+}
+
+/**
+ * @brief Queue top flows of the period for the export writer.
+ *
+ * Period is dropped if the export writer fell behind, see droppedCount.
+ *
+ * @param time_ms end of the period in ms since the epoch
+ * @param period period length in seconds
+ * @param records top flows of the period
+ */
+void FlowWriter::writePeriod(long long time_ms, unsigned int period, const FlowSnapshot &records)
+{
+    text = writer.beginPeriod();
+    if (text == nullptr)
+        return;
+
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        if (format == OutputFormat::JSONL)
+            append("{\"time_ms\":%lld,\"period\":%u,\"rank\":%zu,", time_ms, period, i + 1);
+        else
+            append("%lld,%u,%zu,", time_ms, period, i + 1);
+        appendKey(records[i].first);
+        appendStats(records[i].second);
+        append(format == OutputFormat::JSONL ? "}\n" : "\n");
+    }
+    writer.commitPeriod();
+}
+
+/**
+ * @brief Queue top flows kept across periods for the export writer.
+ *
+ * Period is dropped if the export writer fell behind, see droppedCount.
+ *
+ * @param time_ms end of the period in ms since the epoch
+ * @param records top stored flows
+ */
+void FlowWriter::writeHistory(long long time_ms, const HistorySnapshot &records)
+{
+    text = writer.beginPeriod();
+    if (text == nullptr)
+        return;
+
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        const FlowHistory &history = records[i].second;
+        if (format == OutputFormat::JSONL)
+            append("{\"time_ms\":%lld,\"rank\":%zu,", time_ms, i + 1);
+        else
+            append("%lld,%zu,", time_ms, i + 1);
+        appendKey(records[i].first);
+        appendStats(history.total);
+        for (size_t j = 0; j < RATE_WINDOWS; j++)
+        {
+            if (format == OutputFormat::JSONL)
+                append(",\"rate_%us\":%.3f", FlowStore::windowSeconds(j), history.window_rates[j]);
+            else
+                append(",%.3f", history.window_rates[j]);
+        }
+        append(format == OutputFormat::JSONL ? ",\"peak_rate\":%.3f}\n" : ",%.3f\n", history.peak_rate);
+    }
+    writer.commitPeriod();
+}
@@ -0,0 +1,56 @@
+/**
+ * @file flow_writer.hpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Headless output of the top flows as JSON Lines or CSV records.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef FLOW_WRITER_HPP
+#define FLOW_WRITER_HPP
+
+#include <string>
+#include <cstddef>
+#include "flow_types.hpp"
+#include "flow_store.hpp"
+#include "export_writer.hpp"
+
+enum class OutputFormat
+{
+    TERMINAL, // ncurses view
+    JSONL,    // JSON object per flow and period
+    CSV       // header line, then row per flow and period
+};
+
+/**
+ * @brief Writes the top flows of each period with exact counters to stdout or a file.
+ *
+ * Records of a period are formatted into a buffer of the export writer, which writes it out on
+ * its own thread, so a period costs a single write in most cases. Flows are written in the order
+ * of the snapshot with their rank, addresses in the direction of the first packet of the flow.
+ *
+ * Per-period records hold octets and packets of the period, cumulative records hold the totals
+ * since the flow was first seen and the averaged bandwidths in b/s.
+ */
+class FlowWriter
+{
+private:
+    OutputFormat format;
+    std::string *text; // buffer of the period being formatted
+    ExportWriter writer;
+
+    static std::string header(OutputFormat format, bool cumulative);
+    void append(const char *fmt, ...);
+    void appendKey(const FlowKey &key);
+    void appendStats(const FlowStats &stats);
+
+public:
+    FlowWriter(OutputFormat format, bool cumulative, const char *path, const ExportOptions &options);
+    void writePeriod(long long time_ms, unsigned int period, const FlowSnapshot &records);
+    void writeHistory(long long time_ms, const HistorySnapshot &records);
+    void finish() { writer.finish(); }
+    unsigned long long droppedCount() const { return writer.droppedCount(); }
+};
+
+#endif
@@ -17,17 +17,310 @@
 #include <ncurses.h>
 #include <tuple>
 #include <string>
+#include <chrono>
+#include <cstdio>
+#include <algorithm>
+#include <memory>
 #include "flow_monitor.hpp"
 #include "flow_table.hpp"
 #include "ncurses_terminal_view.hpp"
 #include "argument_parser.hpp"
+#include "flow_writer.hpp"
+#include "export_writer.hpp"
+#include "metrics_server.hpp"
+
+#define HEADLESS_POLL_MS 100 // interval of checking for signals while waiting for the end of the period
 
 // Shared data - application state
-bool running = true;
+volatile std::sig_atomic_t running = 1; // cleared by the signal handler
 void terminate(int signum)
 {
     (void)signum;
-    running = false;
+    running = 0;
+}
+
+/**
+ * @brief Print number of packets which were not accounted, by the reason.
+ * 
+ * @param stats capture counters since the start
+ * @param stream stdout, or stderr if stdout carries the records
+ */
+void printSkipped(const CaptureStats &stats, FILE *stream = stdout)
+{
+    for (size_t i = 1; i < DECODE_STATUS_COUNT; i++) // VALID is never counted
+    {
+        if (stats.skipped[i] > 0)
+            fprintf(stream, "skipped %llu packets: %s\n", stats.skipped[i], decodeStatusName((DecodeStatus)i));
+    }
+}
+
+/**
+ * @brief Print pipeline counters and handler latency percentiles as one line of key=value pairs.
+ * 
+ * @param stats capture counters of the period, or since the start
+ * @param stream stdout, or stderr if stdout carries the records
+ */
+static void printPipeline(const CaptureStats &stats, FILE *stream = stdout)
+{
+    unsigned long long packets = stats.packetsTotal();
+    unsigned long long updates = packets > stats.inserted + stats.rejected ? packets - stats.inserted - stats.rejected : 0;
+    fprintf(stream, "pipeline recv=%llu tcp=%llu udp=%llu icmp=%llu icmp6=%llu skipped=%llu "
+                    "inserts=%llu updates=%llu rejected=%llu wait_ns=%llu p50_ns=%llu p90_ns=%llu p99_ns=%llu max_ns=%llu\n",
+            stats.received, stats.packets[(size_t)TransportProtocol::TCP], stats.packets[(size_t)TransportProtocol::UDP],
+            stats.packets[(size_t)TransportProtocol::ICMP], stats.packets[(size_t)TransportProtocol::ICMPV6], stats.skippedTotal(),
+            stats.inserted, updates, stats.rejected, stats.retire_wait_ns, stats.latencyPercentile(0.5),
+            stats.latencyPercentile(0.9), stats.latencyPercentile(0.99), stats.latencyPercentile(1.0));
+}
+
+/**
+ * @brief Print number of periods which were not exported because the disk fell behind.
+ * 
+ * @param dropped dropped periods since the start
+ * @param stream stdout, or stderr if stdout carries the records
+ */
+void printDropped(unsigned long long dropped, FILE *stream = stdout)
+{
+    if (dropped > 0)
+        fprintf(stream, "dropped %llu periods: export fell behind\n", dropped);
+}
+
+/**
+ * @brief Keep flows across periods if requested.
+ * 
+ * @param monitor 
+ * @param config 
+ */
+void keepFlows(FlowMonitor &monitor, const Config &config)
+{
+    if (config.cumulative)
+    {
+        int period = std::max(config.refresh_time, 1);
+        unsigned int idle_periods = (config.idle_timeout + period - 1) / period;
+        monitor.keepFlows(config.max_flows, idle_periods, period);
+    }
+}
+
+/**
+ * @brief Start the metrics server if requested.
+ * 
+ * @param config 
+ * @return std::unique_ptr<MetricsServer> nullptr without --metrics-listen
+ */
+std::unique_ptr<MetricsServer> startMetrics(const Config &config)
+{
+    std::unique_ptr<MetricsServer> metrics;
+    if (config.metrics_listen != nullptr)
+    {
+        metrics.reset(new MetricsServer(config.metrics_listen));
+    }
+    return metrics;
+}
+
+/**
+ * @brief Capture counters since the start, packets read from the capture file count as received.
+ * 
+ * @param monitor 
+ * @param config 
+ * @return CaptureStats 
+ */
+CaptureStats captureTotals(FlowMonitor &monitor, const Config &config)
+{
+    CaptureStats totals = monitor.getCaptureStats();
+    if (config.capture.file != nullptr)
+    {
+        totals.received = monitor.getPacketCount(); // file has no drops
+    }
+    return totals;
+}
+
+/**
+ * @brief Print pipeline counters of the period to stderr, stdout carries the records.
+ * 
+ * @param monitor 
+ * @param config 
+ * @param previous counters at the end of the previous period
+ * @return CaptureStats counters at the end of this period
+ */
+CaptureStats printPeriodPipeline(FlowMonitor &monitor, const Config &config, const CaptureStats &previous)
+{
+    CaptureStats totals = captureTotals(monitor, config);
+    printPipeline(totals.since(previous), stderr);
+    return totals;
+}
+
+/**
+ * @brief End the period and display its statistics, or the kept flows in cumulative mode.
+ * 
+ * Counters are taken once the period ended, so they include the flows inserted in it.
+ * 
+ * @param monitor 
+ * @param config 
+ * @param totals capture counters at the end of the previous period, updated to this one
+ * @param metrics serves the period too, if not nullptr
+ */
+void showPeriod(FlowMonitor &monitor, const Config &config, CaptureStats &totals, MetricsServer *metrics)
+{
+    if (config.cumulative)
+    {
+        const HistorySnapshot &history = monitor.getHistory();
+        CaptureStats current = captureTotals(monitor, config);
+        updateHistoryView(history, current.since(totals));
+        if (metrics != nullptr)
+            metrics->publishHistory(history, current);
+        totals = current;
+    }
+    else
+    {
+        const FlowSnapshot &records = monitor.getData();
+        CaptureStats current = captureTotals(monitor, config);
+        updateView(records, current.since(totals), config.refresh_time);
+        if (metrics != nullptr)
+            metrics->publishPeriod(records, config.refresh_time, current);
+        totals = current;
+    }
+}
+
+/**
+ * @brief End the period and write its statistics, or the kept flows in cumulative mode, as records.
+ * 
+ * @param monitor 
+ * @param config 
+ * @param writer 
+ * @param time_ms end of the period in ms since the epoch
+ * @param metrics serves the period too, if not nullptr
+ */
+void writePeriod(FlowMonitor &monitor, const Config &config, FlowWriter &writer, long long time_ms, MetricsServer *metrics)
+{
+    if (config.cumulative)
+    {
+        const HistorySnapshot &history = monitor.getHistory();
+        writer.writeHistory(time_ms, history);
+        if (metrics != nullptr)
+            metrics->publishHistory(history, captureTotals(monitor, config));
+    }
+    else
+    {
+        const FlowSnapshot &records = monitor.getData();
+        writer.writePeriod(time_ms, config.refresh_time, records);
+        if (metrics != nullptr)
+            metrics->publishPeriod(records, config.refresh_time, captureTotals(monitor, config));
+    }
+}
+
+/**
+ * @brief Sleep until the end of the period, or until isa-top is terminated.
+ * 
+ * @param period period length in seconds
+ */
+void waitPeriod(unsigned int period)
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(period);
+    while (running && std::chrono::steady_clock::now() < deadline)
+        std::this_thread::sleep_for(std::chrono::milliseconds(HEADLESS_POLL_MS));
+}
+
+/**
+ * @brief Write records of every period to stdout or the output file, without the ncurses view.
+ * 
+ * Capture file is written period by period as fast as possible, or at capture speed with --pace.
+ * 
+ * @param config 
+ * @return int exit code
+ */
+int headless(const Config &config)
+{
+    std::signal(SIGINT, terminate);
+    std::signal(SIGTERM, terminate);
+    try
+    {
+        ExportOptions options = config.export_options;
+        options.lossless = config.capture.file != nullptr && !config.capture.paced; // file is replayed faster than any disk
+        FlowWriter writer(config.format, config.cumulative, config.output, options);
+        std::unique_ptr<MetricsServer> metrics = startMetrics(config);
+        FlowMonitor monitor(config.capture, config.sort_key, config.max_flows, config.top_flows, config.sketch_counters);
+        keepFlows(monitor, config);
+        CaptureStats pipeline; // counters at the end of the previous period, for --stats
+
+        if (config.capture.file != nullptr)
+        {
+            bool more = true;
+            while (running && more)
+            {
+                more = monitor.replayPeriod(config.refresh_time);
+                writePeriod(monitor, config, writer, monitor.replayTime() / 1000, metrics.get());
+                if (config.stats)
+                    pipeline = printPeriodPipeline(monitor, config, pipeline);
+                if (config.capture.paced)
+                    waitPeriod(config.refresh_time);
+            }
+            writer.finish();
+            printSkipped(monitor.getCaptureStats(), stderr);
+            printDropped(writer.droppedCount(), stderr);
+            return 0;
+        }
+
+        std::thread monitor_thread(&FlowMonitor::start, &monitor);
+        try
+        {
+            while (running)
+            {
+                waitPeriod(config.refresh_time);
+                long long time_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+                    std::chrono::system_clock::now().time_since_epoch()).count();
+                writePeriod(monitor, config, writer, time_ms, metrics.get());
+                if (config.stats)
+                    pipeline = printPeriodPipeline(monitor, config, pipeline);
+            }
+        }
+        catch (...)
+        {
+            monitor.stop();
+            monitor_thread.join();
+            throw;
+        }
+        monitor.stop();
+        monitor_thread.join();
+        writer.finish();
+        printSkipped(monitor.getCaptureStats(), stderr);
+        printDropped(writer.droppedCount(), stderr);
+    }
+    catch (const std::exception &ex)
+    {
+        std::cerr << "Error: " << ex.what() << std::endl;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Replay the capture file through the capture pipeline as fast as possible.
+ * 
+ * @param config 
+ * @return int exit code
+ */
+int replay(const Config &config)
+{
+    try
+    {
+        FlowMonitor monitor(config.capture, config.sort_key, config.max_flows, config.top_flows, config.sketch_counters);
+
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        monitor.start();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        monitor.getData();
+
+        unsigned long long packets = monitor.getPacketCount();
+        printf("%llu packets in %.3f s, %.0f packets/s\n", packets, seconds, seconds > 0 ? packets / seconds : 0.0);
+        printSkipped(monitor.getCaptureStats());
+        if (config.stats)
+            printPipeline(captureTotals(monitor, config));
+    }
+    catch (const std::exception &ex)
+    {
+        std::cerr << "Error: " << ex.what() << std::endl;
+        return 1;
+    }
+    return 0;
 }
 
 int main(int argc, char *argv[])
@@ -50,12 +343,48 @@ int main(int argc, char *argv[])
         return 0;
     }
 
+    if (config.format != OutputFormat::TERMINAL)
+    {
+        return headless(config);
+    }
+    if (config.capture.file != nullptr && !config.capture.paced)
+    {
+        return replay(config);
+    }
+
     std::signal(SIGINT, terminate);
-    std::list<std::pair<FlowKey, FlowStats>> view_data;
+    CaptureStats capture_stats;
     
     try
     {
-        FlowMonitor monitor(config.interface, config.sort_key);
+        std::unique_ptr<ExportWriter> screens; // writes screens of the periods into the -d directory
+        if (config.out)
+        {
+            screens.reset(new ExportWriter(config.outDirector, true, ExportOptions(), ""));
+        }
+        std::unique_ptr<MetricsServer> metrics = startMetrics(config);
+        FlowMonitor monitor(config.capture, config.sort_key, config.max_flows, config.top_flows, config.sketch_counters);
+        keepFlows(monitor, config);
+        showPipeline(config.stats, config.capture.timed);
+
+        if (config.capture.paced)
+        {
+            startUI();
+            bool more = true;
+            while (running && more)
+            {
+                more = monitor.replayPeriod(config.refresh_time);
+                showPeriod(monitor, config, capture_stats, metrics.get());
+                if (config.out){
+                    writeWindowToFile(*screens);
+                }
+                waitForInput(config.refresh_time, running);
+            }
+            stopUI();
+            printSkipped(monitor.getCaptureStats());
+            printDropped(screens ? screens->droppedCount() : 0);
+            return 0;
+        }
 
         std::thread monitor_thread(&FlowMonitor::start, &monitor);
 
@@ -63,17 +392,18 @@ int main(int argc, char *argv[])
 
         while (running)
         {
-            view_data = monitor.getData();
-            updateView(view_data, config.refresh_time);
+            showPeriod(monitor, config, capture_stats, metrics.get());
             if (config.out){
-                writeWindowToFile(config.outDirector);
+                writeWindowToFile(*screens);
             }
-            std::this_thread::sleep_for(std::chrono::seconds(config.refresh_time));
+            waitForInput(config.refresh_time, running);
         }
 
         monitor.stop();
         monitor_thread.join();
         stopUI();
+        printSkipped(monitor.getCaptureStats());
+        printDropped(screens ? screens->droppedCount() : 0);
     }
     catch (const std::exception &ex)
     {
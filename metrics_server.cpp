@@ -0,0 +1,442 @@
+/**
+ * @file metrics_server.cpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief OpenMetrics exporter of the top flows and capture counters over HTTP.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "metrics_server.hpp"
+
+#include <sys/socket.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#include <stdexcept>
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
+
+/**
+ * @brief Listen on the address and start the server thread.
+ *
+ * @param address IPv4:port, [IPv6]:port, or :port for all addresses
+ */
+MetricsServer::MetricsServer(const std::string &address) : fresh(false), stopping(false), listen_fd(-1), wake{-1, -1}
+{
+    size_t colon = address.rfind(':');
+    if (colon == std::string::npos)
+        throw std::runtime_error(address + ": Missing port of the metrics address");
+    std::string host = address.substr(0, colon);
+    std::string service = address.substr(colon + 1);
+    if (host.size() >= 2 && host.front() == '[' && host.back() == ']')
+        host = host.substr(1, host.size() - 2);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = AI_PASSIVE | AI_NUMERICHOST | AI_NUMERICSERV;
+    struct addrinfo *addresses = nullptr;
+    int status = getaddrinfo(host.empty() ? nullptr : host.c_str(), service.c_str(), &hints, &addresses);
+    if (status != 0)
+        throw std::runtime_error(address + ": " + gai_strerror(status));
+
+    int reuse = 1;
+    listen_fd = socket(addresses->ai_family, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (listen_fd < 0 ||
+        setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse)) != 0 ||
+        bind(listen_fd, addresses->ai_addr, addresses->ai_addrlen) != 0 ||
+        listen(listen_fd, METRICS_MAX_CLIENTS) != 0 ||
+        pipe2(wake, O_NONBLOCK | O_CLOEXEC) != 0)
+    {
+        std::string error = address + ": " + strerror(errno);
+        freeaddrinfo(addresses);
+        if (listen_fd >= 0)
+            close(listen_fd);
+        throw std::runtime_error(error);
+    }
+    freeaddrinfo(addresses);
+
+    served = "# EOF\n"; // nothing is measured before the first period
+    clients.reserve(METRICS_MAX_CLIENTS);
+    thread = std::thread(&MetricsServer::run, this);
+}
+
+/**
+ * @brief Stop the server thread and close all connections.
+ *
+ */
+MetricsServer::~MetricsServer()
+{
+    {
+        std::lock_guard<std::mutex> lock(m);
+        stopping = true;
+    }
+    char byte = 0;
+    while (write(wake[1], &byte, 1) < 0 && errno == EINTR)
+        ;
+    thread.join();
+    close(listen_fd);
+    close(wake[0]);
+    close(wake[1]);
+}
+
+/**
+ * @brief Port the server listens on, useful if the port 0 was requested.
+ *
+ * @return uint16_t
+ */
+uint16_t MetricsServer::port() const
+{
+    struct sockaddr_storage address;
+    socklen_t length = sizeof(address);
+    if (getsockname(listen_fd, (struct sockaddr *)&address, &length) != 0)
+        return 0;
+    if (address.ss_family == AF_INET6)
+        return ntohs(((struct sockaddr_in6 *)&address)->sin6_port);
+    return ntohs(((struct sockaddr_in *)&address)->sin_port);
+}
+
+/**
+ * @brief Server thread, answers the scrapes until stopped.
+ *
+ * Newest pending body is taken over only when no scrape is being answered, so the
+ * served body never changes under a response.
+ */
+void MetricsServer::run()
+{
+    std::vector<struct pollfd> fds;
+    fds.reserve(METRICS_MAX_CLIENTS + 2);
+    while (true)
+    {
+        fds.clear();
+        fds.push_back({wake[0], POLLIN, 0});
+        fds.push_back({listen_fd, POLLIN, 0});
+        for (const MetricsClient &client : clients)
+            fds.push_back({client.fd, (short)(client.responding ? POLLOUT : POLLIN), 0});
+
+        if (poll(fds.data(), fds.size(), METRICS_POLL_MS) < 0 && errno != EINTR)
+            break;
+
+        if (fds[0].revents != 0)
+        {
+            char bytes[64];
+            while (read(wake[0], bytes, sizeof(bytes)) > 0)
+                ;
+            std::lock_guard<std::mutex> lock(m);
+            if (stopping)
+                break;
+        }
+
+        std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < clients.size(); i++)
+        {
+            MetricsClient &client = clients[i];
+            bool done = false;
+            if (fds[i + 2].revents != 0)
+                done = client.responding ? sendResponse(client) : receiveRequest(client);
+            if (!done && now - client.accepted > std::chrono::milliseconds(METRICS_CLIENT_TIMEOUT_MS))
+                done = true;
+            if (done)
+            {
+                close(client.fd);
+                client.fd = -1;
+            }
+        }
+        clients.erase(std::remove_if(clients.begin(), clients.end(), [](const MetricsClient &client) { return client.fd < 0; }),
+                      clients.end());
+
+        if (fds[1].revents != 0)
+            acceptClients();
+
+        bool answering = std::any_of(clients.begin(), clients.end(), [](const MetricsClient &client) { return client.responding; });
+        if (!answering)
+        {
+            std::lock_guard<std::mutex> lock(m);
+            if (fresh)
+            {
+                served.swap(pending);
+                fresh = false;
+            }
+        }
+    }
+
+    for (const MetricsClient &client : clients)
+        close(client.fd);
+    clients.clear();
+}
+
+/**
+ * @brief Accept waiting connections, connections beyond METRICS_MAX_CLIENTS are closed right away.
+ *
+ */
+void MetricsServer::acceptClients()
+{
+    while (true)
+    {
+        int fd = accept4(listen_fd, nullptr, nullptr, SOCK_NONBLOCK | SOCK_CLOEXEC);
+        if (fd < 0)
+            return;
+        if (clients.size() >= METRICS_MAX_CLIENTS)
+        {
+            close(fd);
+            continue;
+        }
+
+        MetricsClient client;
+        client.fd = fd;
+        client.body_size = 0;
+        client.sent = 0;
+        client.responding = false;
+        client.accepted = std::chrono::steady_clock::now();
+        clients.push_back(client);
+    }
+}
+
+/**
+ * @brief Read the request, respond once its head is complete.
+ *
+ * @param client
+ * @return true if the connection is finished
+ */
+bool MetricsServer::receiveRequest(MetricsClient &client)
+{
+    char buffer[1024];
+    ssize_t length = recv(client.fd, buffer, sizeof(buffer), 0);
+    if (length == 0)
+        return true;
+    if (length < 0)
+        return errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR;
+
+    client.request.append(buffer, length);
+    if (client.request.find("\r\n\r\n") == std::string::npos && client.request.find("\n\n") == std::string::npos)
+        return client.request.size() > METRICS_REQUEST_SIZE;
+    return respond(client);
+}
+
+/**
+ * @brief Answer GET /metrics with the served body, anything else with an error status.
+ *
+ * @param client client with the complete request head
+ * @return true if the connection is finished
+ */
+bool MetricsServer::respond(MetricsClient &client)
+{
+    const std::string &request = client.request;
+    const char *status = "200 OK";
+    if (request.compare(0, 4, "GET ") != 0)
+        status = "405 Method Not Allowed";
+    else if (request.compare(4, 8, "/metrics") != 0 || (request[12] != ' ' && request[12] != '?'))
+        status = "404 Not Found";
+
+    char head[256];
+    if (status[0] == '2')
+    {
+        client.body_size = served.size();
+        snprintf(head, sizeof(head),
+                 "HTTP/1.1 %s\r\nContent-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n"
+                 "Content-Length: %zu\r\nConnection: close\r\n\r\n",
+                 status, client.body_size);
+    }
+    else
+    {
+        client.body_size = 0;
+        snprintf(head, sizeof(head), "HTTP/1.1 %s\r\nContent-Length: 0\r\nConnection: close\r\n\r\n", status);
+    }
+    client.head = head;
+    client.sent = 0;
+    client.responding = true;
+    return sendResponse(client);
+}
+
+/**
+ * @brief Send as much of the response as the socket takes.
+ *
+ * @param client
+ * @return true if the connection is finished
+ */
+bool MetricsServer::sendResponse(MetricsClient &client)
+{
+    size_t total = client.head.size() + client.body_size;
+    while (client.sent < total)
+    {
+        const char *data;
+        size_t left;
+        if (client.sent < client.head.size())
+        {
+            data = client.head.data() + client.sent;
+            left = client.head.size() - client.sent;
+        }
+        else
+        {
+            data = served.data() + (client.sent - client.head.size());
+            left = total - client.sent;
+        }
+
+        ssize_t length = ::send(client.fd, data, left, MSG_NOSIGNAL);
+        if (length < 0 && errno == EINTR)
+            continue;
+        if (length < 0)
+            return errno != EAGAIN && errno != EWOULDBLOCK;
+        client.sent += length;
+    }
+    return true;
+}
+
+/**
+ * @brief Append formatted text to the body being rendered.
+ *
+ * Formatted text must be shorter than FORMAT_RECORD_SIZE.
+ *
+ * @param fmt printf format
+ */
+void MetricsServer::append(const char *fmt, ...)
+{
+    va_list args;
+    va_start(args, fmt);
+    appendFormat(rendering, fmt, args);
+    va_end(args);
+}
+
+/**
+ * @brief Append the type and help of the metric family.
+ *
+ * @param name family name, counter samples carry the _total suffix
+ * @param type gauge or counter
+ * @param help
+ */
+void MetricsServer::appendFamily(const char *name, const char *type, const char *help)
+{
+    append("# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+/**
+ * @brief Append sample name and labels of the flow, without the closing brace.
+ *
+ * @param name sample name
+ * @param rank position of the flow, starting with 1
+ * @param key flow key in the direction of the first packet
+ */
+void MetricsServer::appendSample(const char *name, size_t rank, const FlowKey &key)
+{
+    FlowKeyText addresses(key);
+    append("%s{rank=\"%zu\",src=\"%s\",src_port=\"%u\",dst=\"%s\",dst_port=\"%u\",protocol=\"%s\"",
+           name, rank, addresses.src, (unsigned int)key.src_port, addresses.dst, (unsigned int)key.dst_port,
+           transportProtocolName(transportProtocol(key.protocol)));
+}
+
+/**
+ * @brief Append capture counters and protocol totals since the start, then the end of the exposition.
+ *
+ * @param capture capture counters since the start
+ */
+void MetricsServer::appendCapture(const CaptureStats &capture)
+{
+    appendFamily("isatop_received_packets", "counter", "Packets received by the capture sockets.");
+    append("isatop_received_packets_total %llu\n", capture.received);
+    appendFamily("isatop_dropped_packets", "counter", "Packets dropped because the capture buffer or ring was full.");
+    append("isatop_dropped_packets_total %llu\n", capture.dropped);
+    appendFamily("isatop_interface_dropped_packets", "counter", "Packets dropped by the interface or its driver.");
+    append("isatop_interface_dropped_packets_total %llu\n", capture.interface_dropped);
+
+    appendFamily("isatop_skipped_packets", "counter", "Packets not accounted, by the reason.");
+    for (size_t i = 1; i < DECODE_STATUS_COUNT; i++) // VALID is never counted
+        append("isatop_skipped_packets_total{reason=\"%s\"} %llu\n", decodeStatusName((DecodeStatus)i), capture.skipped[i]);
+
+    appendFamily("isatop_protocol_packets", "counter", "Accounted packets by the transport protocol.");
+    for (size_t i = 0; i < TRANSPORT_PROTOCOL_COUNT; i++)
+        append("isatop_protocol_packets_total{protocol=\"%s\"} %llu\n", transportProtocolName((TransportProtocol)i), capture.packets[i]);
+    appendFamily("isatop_protocol_bytes", "counter", "Accounted octets by the transport protocol.");
+    for (size_t i = 0; i < TRANSPORT_PROTOCOL_COUNT; i++)
+        append("isatop_protocol_bytes_total{protocol=\"%s\"} %llu\n", transportProtocolName((TransportProtocol)i), capture.bytes[i]);
+
+    append("# EOF\n");
+}
+
+/**
+ * @brief Hand the rendered body over to the server thread.
+ *
+ */
+void MetricsServer::publish()
+{
+    {
+        std::lock_guard<std::mutex> lock(m);
+        rendering.swap(pending);
+        fresh = true;
+    }
+    char byte = 0;
+    while (write(wake[1], &byte, 1) < 0 && errno == EINTR)
+        ;
+}
+
+/**
+ * @brief Render rates of the top flows of the period and the capture counters, then serve them.
+ *
+ * @param records top flows of the period
+ * @param period period length in seconds
+ * @param capture capture counters since the start
+ */
+void MetricsServer::publishPeriod(const FlowSnapshot &records, unsigned int period, const CaptureStats &capture)
+{
+    static const struct
+    {
+        const char *name;
+        const char *help;
+        unsigned long long FlowStats::*counter;
+    } families[] = {
+        {"isatop_flow_rx_bytes_per_second", "Received octets per second of the top flows in the last period.", &FlowStats::rx_bytes},
+        {"isatop_flow_rx_packets_per_second", "Received packets per second of the top flows in the last period.", &FlowStats::rx_packets},
+        {"isatop_flow_tx_bytes_per_second", "Transmitted octets per second of the top flows in the last period.", &FlowStats::tx_bytes},
+        {"isatop_flow_tx_packets_per_second", "Transmitted packets per second of the top flows in the last period.", &FlowStats::tx_packets},
+    };
+
+    double seconds = std::max(period, 1u);
+    rendering.clear();
+    for (const auto &family : families)
+    {
+        appendFamily(family.name, "gauge", family.help);
+        for (size_t i = 0; i < records.size(); i++)
+        {
+            appendSample(family.name, i + 1, records[i].first);
+            append("} %.3f\n", records[i].second.*family.counter / seconds);
+        }
+    }
+    appendCapture(capture);
+    publish();
+}
+
+/**
+ * @brief Render averaged bandwidths of the top kept flows and the capture counters, then serve them.
+ *
+ * @param records top stored flows
+ * @param capture capture counters since the start
+ */
+void MetricsServer::publishHistory(const HistorySnapshot &records, const CaptureStats &capture)
+{
+    rendering.clear();
+    appendFamily("isatop_flow_bits_per_second", "gauge", "Bandwidth of the top kept flows averaged over the window.");
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        for (size_t j = 0; j < RATE_WINDOWS; j++)
+        {
+            appendSample("isatop_flow_bits_per_second", i + 1, records[i].first);
+            append(",window=\"%us\"} %.3f\n", FlowStore::windowSeconds(j), records[i].second.window_rates[j]);
+        }
+    }
+    appendFamily("isatop_flow_peak_bits_per_second", "gauge", "Bandwidth of the busiest period of the top kept flows.");
+    for (size_t i = 0; i < records.size(); i++)
+    {
+        appendSample("isatop_flow_peak_bits_per_second", i + 1, records[i].first);
+        append("} %.3f\n", records[i].second.peak_rate);
+    }
+    appendCapture(capture);
+    publish();
+}
@@ -0,0 +1,92 @@
+/**
+ * @file metrics_server.hpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief OpenMetrics exporter of the top flows and capture counters over HTTP.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef METRICS_SERVER_HPP
+#define METRICS_SERVER_HPP
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include "flow_table.hpp"
+#include "flow_store.hpp"
+#include "capturing_utils.hpp"
+
+#define METRICS_MAX_CLIENTS 16          // connections served at once, further ones are closed
+#define METRICS_REQUEST_SIZE 4096       // longest accepted request head
+#define METRICS_CLIENT_TIMEOUT_MS 5000  // connection is closed if the scrape takes longer
+#define METRICS_POLL_MS 1000            // interval of checking for timed out connections
+
+/**
+ * @brief Connection of a scraper, read until the end of the request head, then answered and closed.
+ *
+ */
+struct MetricsClient
+{
+    int fd;
+    std::string request;
+    std::string head; // status line and headers of the response
+    size_t body_size; // octets of the served body sent after the head, 0 for errors
+    size_t sent;      // octets of head and body sent
+    bool responding;
+    std::chrono::steady_clock::time_point accepted;
+};
+
+/**
+ * @brief Serves the metrics of the last period to Prometheus on its own thread.
+ *
+ * The refresh loop renders each period into a response body and swaps it with the pending
+ * one, the server thread swaps the pending body with the served one once no scrape is being
+ * answered. Three bodies are reused in every period, so scrapes never wait for the capture
+ * or the refresh loop, and no memory is allocated once the bodies have grown.
+ *
+ * The server thread polls the listening socket, the connections and a pipe which wakes it up
+ * when a new body is pending or the server is stopped. GET /metrics is answered with the body
+ * as OpenMetrics text, then the connection is closed.
+ */
+class MetricsServer
+{
+private:
+    std::mutex m;
+    std::string pending; // rendered body not yet served
+    bool fresh;          // pending body is newer than the served one
+    bool stopping;
+
+    std::string rendering; // body being rendered by the refresh loop
+
+    // Used by the server thread only after the construction
+    int listen_fd;
+    int wake[2]; // pipe waking the server thread
+    std::string served; // body answered to the scrapes
+    std::vector<MetricsClient> clients;
+    std::thread thread;
+
+    void run();
+    void acceptClients();
+    bool receiveRequest(MetricsClient &client);
+    bool respond(MetricsClient &client);
+    bool sendResponse(MetricsClient &client);
+    void append(const char *fmt, ...);
+    void appendFamily(const char *name, const char *type, const char *help);
+    void appendSample(const char *name, size_t rank, const FlowKey &key);
+    void appendCapture(const CaptureStats &capture);
+    void publish();
+
+public:
+    explicit MetricsServer(const std::string &address);
+    ~MetricsServer();
+    uint16_t port() const;
+    void publishPeriod(const FlowSnapshot &records, unsigned int period, const CaptureStats &capture);
+    void publishHistory(const HistorySnapshot &records, const CaptureStats &capture);
+};
+
+#endif
@@ -8,14 +8,22 @@
  */
 
 #include "flow_table.hpp"
+#include "flow_store.hpp"
 #include "ncurses_terminal_view.hpp"
 
 #include <ncurses.h>
-#include <tuple>
+#include <netinet/in.h>
+#include <arpa/inet.h>
 #include <string>
-#include <fstream>
+#include <vector>
 #include <cmath>
+#include <cstdio>
+#include <cstdarg>
+#include <cstring>
 #include <iostream>
+#include <chrono>
+#include <csignal>
+#include <algorithm>
 
 /* Capture Table
 
@@ -47,33 +55,17 @@ NOTE: if width < 16 dont show proto and Tx
 #define TX "%-*.*s%-*.*s%.0s%.0s%.0s%-6s   %-6s"
 #define CLEAR "%-*.*s%-*.*s%.0s%.0s%.0s%.0s"
 
-/**
- * @brief Write current ncurses buffer to the file.
- * 
- * @param out output directory path
- */
-void writeWindowToFile(const std::string &out)
-{
-    static int cnt = 0;
-    std::string filename = out + "/" + "out-" + std::to_string(cnt) + ".txt";
-    cnt++;
-    std::ofstream outfile(filename, std::ios::app);
-    if (!outfile)
-    {
-        return;
-    }
-
-    char buffer[2048];
-    int rows, cols;
-    getmaxyx(stdscr, rows, cols);
+// Row layouts of the cumulative mode, rate columns are 2s, 10s, 40s, peak and total
+//  SRC      DST     Proto     2s     10s    40s    peak   total
+#define SRC_DST_PROTO_WINDOWS "%-*.*s  %-*.*s   %-5s   %-6s   %-6s   %-6s   %-6s   %-6s"
+#define PROTO_WINDOWS "%-*.*s%-*.*s%-5s   %-6s   %-6s   %-6s   %-6s   %-6s"
+#define WINDOWS "%-*.*s%-*.*s%.0s%-6s   %-6s   %-6s   %-6s   %-6s"
+#define CLEAR_WINDOWS "%-*.*s%-*.*s%.0s%.0s%.0s%.0s%.0s%.0s"
 
-    for (int i = 0; i < rows; ++i)
-    {
-        mvwinstr(stdscr, i, 0, buffer);
-        outfile << buffer << std::endl;
-    }
-    outfile.close();
-}
+#define ENDPOINT_FORMAT_SIZE 56 // [IPv6]:port and the terminator
+#define DURATION_FORMAT_SIZE 24 // 18446744073709.6ms and the terminator
+#define PIPELINE_ROWS 3         // rows of the pipeline pane
+#define INPUT_POLL_MS 100       // interval of checking for signals while waiting for keys
 
 /**
  * @brief Convert number of captured bytes in period in number of bits per second.
@@ -103,11 +95,12 @@ double toPacketsPerSecond(unsigned long long packets, unsigned int period)
  * @brief Format measured bandwidth into human readable format
  * 
  * @param bandwidth number of bits per second
- * @return std::string 
+ * @param text buffer of MAGNITUDE_FORMAT_SIZE characters
+ * @return const char* text
  */
-std::string toOrderOfMagnitudeFormat(double bandwidth)
+const char *toOrderOfMagnitudeFormat(double bandwidth, char *text)
 {
-    const char *orders_of_magnitude[] = {"", "K", "M", "G", "T", "P"};
+    const char orders_of_magnitude[] = "KMGTP";
     int order = 0;
     while (bandwidth >= 1000.0)
     {
@@ -116,85 +109,265 @@ std::string toOrderOfMagnitudeFormat(double bandwidth)
     }
 
     int int_val = std::round(bandwidth * 10.0);
+    char *end = text;
     if (int_val == 0)
-        return "0";
-
-    std::string str_val = std::to_string(int_val);
-    std::string str_order = order < 6 ? orders_of_magnitude[order] : "X"; // Orders greater than petabytes are ignored
-
-    
-    if (str_val.size() == 4) // xxx.x[KMGTP]
     {
-        return str_val.substr(0, 3) + "." + str_val.substr(3,1) + str_order;
+        *end++ = '0';
     }
-    else if (str_val.size() == 3) // xx.x[KMGTP]
+    else if (int_val < 10000) // 0.x, x.x[KMGTP], xx.x[KMGTP], xxx.x[KMGTP]
     {
-        return str_val.substr(0, 2) + "." + str_val.substr(2,1) + str_order;
+        int whole = int_val / 10;
+        if (whole >= 100)
+            *end++ = '0' + whole / 100;
+        if (whole >= 10)
+            *end++ = '0' + whole / 10 % 10;
+        *end++ = '0' + whole % 10;
+        *end++ = '.';
+        *end++ = '0' + int_val % 10;
+        if (order > 0 && whole > 0)
+            *end++ = order < 6 ? orders_of_magnitude[order - 1] : 'X'; // Orders greater than petabytes are ignored
     }
-    else if (str_val.size() == 2) // x.x[KMGTP]
+    else                      // 0.0
     {
-        return str_val.substr(0,1) + "." + str_val.substr(1,1) + str_order;
+        memcpy(end, "0.0", 3);
+        end += 3;
     }
-    else if (str_val.size() == 1) // 0.x
+    *end = '\0';
+    return text;
+}
+
+/**
+ * @brief Convert protocol number into the string representation.
+ * 
+ * @param protocol_number 
+ * @return const char* 
+ */
+const char *toProtocolColumnFormat(uint8_t protocol_number)
+{
+    switch (protocol_number)
     {
-        return "0." + str_val;
+    case IPPROTO_TCP:
+        return "tcp";
+    case IPPROTO_UDP:
+        return "udp";
+    case IPPROTO_ICMP:
+        return "icmp";
+    case IPPROTO_ICMPV6:
+        return "icmp6";
+    default:
+        return "Unknown";
     }
-    else                          // 0.0  
+}
+
+/**
+ * @brief Format single flow endpoint as IPv4:port or [IPv6]:port, port is omitted if zero.
+ * 
+ * @param address binary address
+ * @param port 
+ * @param ip address class
+ * @param text buffer of ENDPOINT_FORMAT_SIZE characters
+ * @return const char* text
+ */
+const char *toEndpointFormat(const IpAddress &address, uint16_t port, IpAddrClass ip, char *text)
+{
+    char address_text[INET6_ADDRSTRLEN];
+    inet_ntop(ip == IpAddrClass::IPV4 ? AF_INET : AF_INET6, address.bytes, address_text, sizeof(address_text));
+
+    const char *fmt = ip == IpAddrClass::IPV4 ? "%s" : "[%s]";
+    int length = snprintf(text, ENDPOINT_FORMAT_SIZE, fmt, address_text);
+    if (port != 0)
+        snprintf(text + length, ENDPOINT_FORMAT_SIZE - length, ":%u", (unsigned int)port);
+    return text;
+}
+
+// Frame being rendered and frame shown on the screen, one character per cell, row by row.
+// Buffers are reallocated only when the screen size changes.
+static std::vector<char> frame;
+static std::vector<char> shown;
+static std::vector<char> line_text; // formatted text of one printed line
+static int frame_rows = 0;
+static int frame_columns = 0;
+
+/**
+ * @brief Start rendering a new frame of blank cells matching the screen size.
+ * 
+ * After the screen was resized, nothing is known about its content, so the next
+ * refresh repaints it entirely.
+ */
+void beginFrame()
+{
+    int rows, columns;
+    getmaxyx(stdscr, rows, columns);
+    rows = std::max(rows, 0);
+    columns = std::max(columns, 0);
+    if (rows != frame_rows || columns != frame_columns)
     {
-        return "0.0";
+        frame_rows = rows;
+        frame_columns = columns;
+        frame.assign((size_t)rows * columns, ' ');
+        shown.assign((size_t)rows * columns, '\0'); // differs from every rendered cell
+        line_text.assign(columns + 1, '\0');
+        clear();
     }
+    std::fill(frame.begin(), frame.end(), ' ');
 }
 
 /**
- * @brief 
+ * @brief Print formatted text into the frame like mvprintw, text beyond the row is cut off.
  * 
- * @param record 
- * @return std::tuple<std::string, std::string> 
+ * @param row 
+ * @param column 
+ * @param fmt printf format
  */
-std::tuple<std::string, std::string> toAddressColumnFormat(FlowKey record)
+void printCells(int row, int column, const char *fmt, ...)
 {
-    std::string src;
-    std::string dst;
+    if (row < 0 || row >= frame_rows || column < 0 || column >= frame_columns)
+        return;
 
-    if (record.ip == IpAddrClass::IPV4)
+    va_list args;
+    va_start(args, fmt);
+    int length = vsnprintf(line_text.data(), line_text.size(), fmt, args);
+    va_end(args);
+
+    length = std::min(length, frame_columns - column);
+    if (length > 0)
+        memcpy(frame.data() + (size_t)row * frame_columns + column, line_text.data(), length);
+}
+
+/**
+ * @brief Write cells which differ from the shown frame to the screen.
+ * 
+ * Each row is compared with the shown frame and only the span from its first to its last
+ * changed cell is written, ncurses then sends only the changed cells to the terminal.
+ */
+void flushFrame()
+{
+    for (int row = 0; row < frame_rows; row++)
     {
-        src = record.src_address + (record.src_port != 0 ? (":" + std::to_string(record.src_port)) : "");
-        dst = record.dst_address + (record.dst_port != 0 ? (":" + std::to_string(record.dst_port)) : "");
+        const char *cells = frame.data() + (size_t)row * frame_columns;
+        char *shown_cells = shown.data() + (size_t)row * frame_columns;
+
+        int first = 0;
+        while (first < frame_columns && cells[first] == shown_cells[first])
+            first++;
+        if (first == frame_columns) // Unchanged
+            continue;
+        int last = frame_columns - 1;
+        while (cells[last] == shown_cells[last])
+            last--;
+
+        mvaddnstr(row, first, cells + first, last - first + 1);
+        memcpy(shown_cells + first, cells + first, last - first + 1);
     }
-    else
-    { // IPv6
-        src = "[" + record.src_address + "]" + (record.src_port != 0 ? (":" + std::to_string(record.src_port)) : "");
-        dst = "[" + record.dst_address + "]" + (record.dst_port != 0 ? (":" + std::to_string(record.dst_port)) : "");
+    refresh();
+}
+
+/**
+ * @brief Queue the shown frame for the export writer, which writes it into the next out-N.txt.
+ * 
+ * Period is dropped if the export writer fell behind.
+ * 
+ * @param writer export writer of the output directory
+ */
+void writeWindowToFile(ExportWriter &writer)
+{
+    std::string *text = writer.beginPeriod();
+    if (text == nullptr)
+        return;
+
+    for (int row = 0; row < frame_rows; row++)
+    {
+        text->append(shown.data() + (size_t)row * frame_columns, frame_columns);
+        text->push_back('\n');
     }
+    writer.commitPeriod();
+}
 
-    return {src, dst};
+/**
+ * @brief Print position indicator in the row between header and records, only if the table is paged.
+ * 
+ * @param count number of records
+ * @param first index of the first displayed record
+ * @param rows number of rows available for records
+ */
+void printPosition(size_t count, size_t first, int rows)
+{
+    if (count > (size_t)rows && rows > 0)
+    {
+        size_t last = std::min(first + rows, count);
+        printCells(2, 1, "%zu-%zu/%zu", first + 1, last, count);
+    }
 }
 
 /**
- * @brief Print body of the bandwidth table containing top 10 most communication flows
+ * @brief Print visible page of the bandwidth table body containing top communicating flows
  * 
- * @param records list of top ten communicating flows
+ * @param records top communicating flows
  * @param fmt print format
  * @param src_dst_width width of address column
  * @param period capture period
+ * @param first index of the first displayed record (from max to min)
+ * @param rows number of rows available for records
+ */
+void printRecords(const FlowSnapshot &records, const char *fmt, int src_dst_width, unsigned int period,
+                  size_t first, int rows)
+{
+    char src[ENDPOINT_FORMAT_SIZE], dst[ENDPOINT_FORMAT_SIZE];
+    char rx_bits[MAGNITUDE_FORMAT_SIZE], rx_packets[MAGNITUDE_FORMAT_SIZE];
+    char tx_bits[MAGNITUDE_FORMAT_SIZE], tx_packets[MAGNITUDE_FORMAT_SIZE];
+
+    int line = 3; // first two rows are header
+    auto it = records.begin() + std::min(first, records.size()); // from max to min
+    for (; it != records.end() && line < 3 + rows; it++)
+    {
+        const FlowKey &key = it->first;
+        printCells(line, 1, fmt,
+                   src_dst_width, src_dst_width, toEndpointFormat(key.src_address, key.src_port, key.ip, src),
+                   src_dst_width, src_dst_width, toEndpointFormat(key.dst_address, key.dst_port, key.ip, dst),
+                   toProtocolColumnFormat(key.protocol),
+                   toOrderOfMagnitudeFormat(toBitsPerSecond(it->second.rx_bytes, period), rx_bits),
+                   toOrderOfMagnitudeFormat(toPacketsPerSecond(it->second.rx_packets, period), rx_packets),
+                   toOrderOfMagnitudeFormat(toBitsPerSecond(it->second.tx_bytes, period), tx_bits),
+                   toOrderOfMagnitudeFormat(toPacketsPerSecond(it->second.tx_packets, period), tx_packets));
+        line++;
+    }
+    printPosition(records.size(), first, rows);
+}
+
+/**
+ * @brief Print visible page of the cumulative table body.
+ * 
+ * @param records top flows with their history
+ * @param fmt print format
+ * @param src_dst_width width of address column
+ * @param first index of the first displayed record (from max to min)
+ * @param rows number of rows available for records
  */
-void printRecords(std::list<std::pair<FlowKey, FlowStats>> records, const char *fmt, int src_dst_width, unsigned int period)
+void printHistoryRecords(const HistorySnapshot &records, const char *fmt, int src_dst_width,
+                         size_t first, int rows)
 {
+    char src[ENDPOINT_FORMAT_SIZE], dst[ENDPOINT_FORMAT_SIZE];
+    char rates[RATE_WINDOWS][MAGNITUDE_FORMAT_SIZE], peak[MAGNITUDE_FORMAT_SIZE], total[MAGNITUDE_FORMAT_SIZE];
+
     int line = 3; // first two rows are header
-    for (auto it = records.rbegin(); it != records.rend(); it++) // from max to min
+    auto it = records.begin() + std::min(first, records.size()); // from max to min
+    for (; it != records.end() && line < 3 + rows; it++)
     {
-        std::tuple<std::string, std::string> addresses = toAddressColumnFormat(it->first);
-
-        mvprintw(line, 1, fmt,
-                 src_dst_width, src_dst_width, std::get<0>(addresses).c_str(),
-                 src_dst_width, src_dst_width, std::get<1>(addresses).c_str(),
-                 (it->first.protocol).c_str(),
-                 (toOrderOfMagnitudeFormat(toBitsPerSecond(it->second.rx_bytes, period))).c_str(),
-                 (toOrderOfMagnitudeFormat(toPacketsPerSecond(it->second.rx_packets, period))).c_str(),
-                 (toOrderOfMagnitudeFormat(toBitsPerSecond(it->second.tx_bytes, period))).c_str(),
-                 (toOrderOfMagnitudeFormat(toPacketsPerSecond(it->second.tx_packets, period))).c_str());
+        const FlowKey &key = it->first;
+        const FlowHistory &history = it->second;
+
+        printCells(line, 1, fmt,
+                   src_dst_width, src_dst_width, toEndpointFormat(key.src_address, key.src_port, key.ip, src),
+                   src_dst_width, src_dst_width, toEndpointFormat(key.dst_address, key.dst_port, key.ip, dst),
+                   toProtocolColumnFormat(key.protocol),
+                   toOrderOfMagnitudeFormat(history.window_rates[0], rates[0]),
+                   toOrderOfMagnitudeFormat(history.window_rates[1], rates[1]),
+                   toOrderOfMagnitudeFormat(history.window_rates[2], rates[2]),
+                   toOrderOfMagnitudeFormat(history.peak_rate, peak),
+                   toOrderOfMagnitudeFormat(history.total.rx_bytes + history.total.tx_bytes, total));
         line++;
     }
+    printPosition(records.size(), first, rows);
 }
 
 /**
@@ -206,62 +379,327 @@ void printRecords(std::list<std::pair<FlowKey, FlowStats>> records, const char *
 void printHeader(const char *fmt, int src_dst_width)
 {
 
-    mvprintw(0, 1, fmt, src_dst_width, src_dst_width, "Src IP:port",
-             src_dst_width, src_dst_width, "Dst IP:port",
-             "Proto",
-             "Rx", "", "Tx", "");
-    mvprintw(1, 1, fmt, src_dst_width, src_dst_width, "",
-             src_dst_width, src_dst_width, "",
-             "",
-             "b/s", "p/s", "b/s", "p/s");
+    printCells(0, 1, fmt, src_dst_width, src_dst_width, "Src IP:port",
+               src_dst_width, src_dst_width, "Dst IP:port",
+               "Proto",
+               "Rx", "", "Tx", "");
+    printCells(1, 1, fmt, src_dst_width, src_dst_width, "",
+               src_dst_width, src_dst_width, "",
+               "",
+               "b/s", "p/s", "b/s", "p/s");
+}
+
+/**
+ * @brief Print header of the cumulative table.
+ * 
+ * @param fmt print format
+ * @param src_dst_width width of address column
+ */
+void printHistoryHeader(const char *fmt, int src_dst_width)
+{
+    char windows[RATE_WINDOWS][MAGNITUDE_FORMAT_SIZE];
+    for (size_t i = 0; i < RATE_WINDOWS; i++)
+        snprintf(windows[i], sizeof(windows[i]), "%us", FlowStore::windowSeconds(i));
+
+    printCells(0, 1, fmt, src_dst_width, src_dst_width, "Src IP:port",
+               src_dst_width, src_dst_width, "Dst IP:port",
+               "Proto",
+               windows[0], windows[1], windows[2], "peak", "total");
+    printCells(1, 1, fmt, src_dst_width, src_dst_width, "",
+               src_dst_width, src_dst_width, "",
+               "",
+               "b/s", "b/s", "b/s", "b/s", "B");
+}
+
+/**
+ * @brief Print capture counters of the period, right-aligned in the row between header and records.
+ * 
+ * Omitted if the row is too narrow to hold them next to the position indicator.
+ * 
+ * @param capture capture counters of the period
+ */
+void printCaptureStats(const CaptureStats &capture)
+{
+    char text[96];
+    int length = snprintf(text, sizeof(text), "recv %llu drop %llu ifdrop %llu skip %llu",
+                          capture.received, capture.dropped, capture.interface_dropped, capture.skippedTotal());
+    int column = frame_columns - length - 1;
+    if (column >= 24) // room for the position indicator
+        printCells(2, column, "%s", text);
+}
+
+/**
+ * @brief Format duration with the unit matching its magnitude.
+ * 
+ * @param ns 
+ * @param text buffer of DURATION_FORMAT_SIZE characters
+ * @return const char* text
+ */
+static const char *toDurationFormat(unsigned long long ns, char *text)
+{
+    if (ns < 1000)
+        snprintf(text, DURATION_FORMAT_SIZE, "%lluns", ns);
+    else if (ns < 1000000)
+        snprintf(text, DURATION_FORMAT_SIZE, "%.1fus", ns / 1000.0);
+    else
+        snprintf(text, DURATION_FORMAT_SIZE, "%.1fms", ns / 1000000.0);
+    return text;
 }
 
 /**
- * @brief Print header and table body.
+ * @brief Print pipeline counters of the period into the rows at the bottom of the screen.
  * 
- * @param records list of top ten communicating flows
+ * @param capture capture counters of the period
+ * @param row first row of the pane
+ * @param timed handler latency of the packets was measured
+ */
+static void printPipeline(const CaptureStats &capture, int row, bool timed)
+{
+    printCells(row, 1, "recv %llu  tcp %llu  udp %llu  icmp %llu  icmp6 %llu  skip %llu",
+               capture.received, capture.packets[(size_t)TransportProtocol::TCP], capture.packets[(size_t)TransportProtocol::UDP],
+               capture.packets[(size_t)TransportProtocol::ICMP], capture.packets[(size_t)TransportProtocol::ICMPV6],
+               capture.skippedTotal());
+
+    unsigned long long packets = capture.packetsTotal();
+    unsigned long long updates = packets > capture.inserted + capture.rejected ? packets - capture.inserted - capture.rejected : 0;
+    char wait[DURATION_FORMAT_SIZE];
+    printCells(row + 1, 1, "table inserts %llu  updates %llu  rejected %llu  retire wait %s",
+               capture.inserted, updates, capture.rejected, toDurationFormat(capture.retire_wait_ns, wait));
+
+    if (!timed)
+    {
+        printCells(row + 2, 1, "handler/packet latency is measured with --stats");
+        return;
+    }
+    char p50[DURATION_FORMAT_SIZE], p90[DURATION_FORMAT_SIZE], p99[DURATION_FORMAT_SIZE], max[DURATION_FORMAT_SIZE];
+    printCells(row + 2, 1, "handler/packet p50 %s  p90 %s  p99 %s  max %s",
+               toDurationFormat(capture.latencyPercentile(0.5), p50), toDurationFormat(capture.latencyPercentile(0.9), p90),
+               toDurationFormat(capture.latencyPercentile(0.99), p99), toDurationFormat(capture.latencyPercentile(1.0), max));
+}
+
+/**
+ * @brief Print header and visible page of the table body.
+ * 
+ * @param records top communicating flows
  * @param fmt print format
  * @param src_dst_width width of address column
  * @param period capture period
+ * @param first index of the first displayed record
+ * @param rows number of rows available for records
  */
-void printTable(std::list<std::pair<FlowKey, FlowStats>> records, const char *fmt, int src_dst_width, unsigned int period)
+void printTable(const FlowSnapshot &records, const char *fmt, int src_dst_width, unsigned int period,
+                size_t first, int rows)
 {
     printHeader(fmt, src_dst_width);
-    printRecords(records, fmt, src_dst_width, period);
+    printRecords(records, fmt, src_dst_width, period, first, rows);
 }
 
+/**
+ * @brief Print header and visible page of the cumulative table with layout matching the screen width.
+ * 
+ * @param records top flows with their history
+ * @param screen_width
+ * @param first index of the first displayed record
+ * @param rows number of rows available for records
+ */
+void printHistoryTable(const HistorySnapshot &records, int screen_width, size_t first, int rows)
+{
+    const char *fmt;
+    int src_dst_width = 0;
+    if (screen_width < 44) // empty
+    {
+        fmt = CLEAR_WINDOWS;
+    }
+    else if (screen_width < 52) // rates
+    {
+        fmt = WINDOWS;
+    }
+    else if ((screen_width - 57) / 2 < 2) // PROTO rates
+    {
+        fmt = PROTO_WINDOWS;
+    }
+    else // Full
+    {
+        fmt = SRC_DST_PROTO_WINDOWS;
+        src_dst_width = (screen_width - 57) / 2;
+    }
+    printHistoryHeader(fmt, src_dst_width);
+    printHistoryRecords(records, fmt, src_dst_width, first, rows);
+}
+
+// Displayed data - kept between refreshes for paging, capacity is reused in every period
+static FlowSnapshot view_records;
+static CaptureStats view_capture;
+static unsigned int view_period = 1;
+static size_t view_first = 0;
+static HistorySnapshot view_history; // cumulative mode
+static bool view_cumulative = false;
+static bool view_pipeline = false; // pipeline pane is shown
+static bool view_timed = false;    // handler latency is measured
 
 /**
- * @brief Update ncurses view with table.
+ * @brief Number of screen rows available for records.
  * 
- * @param records list of top ten communicating flows
- * @param period capture period
+ * @return int 
  */
-void updateView(std::list<std::pair<FlowKey, FlowStats>> records, unsigned int period)
+int recordRows()
 {
-    clear();
-    int screen_width = getmaxx(stdscr);
-    if (screen_width < 16) // empty
+    return std::max(getmaxy(stdscr) - 3 - (view_pipeline ? PIPELINE_ROWS : 0), 0);
+}
+
+/**
+ * @brief Show or hide the pane with pipeline counters, toggled by the i key.
+ * 
+ * @param shown 
+ * @param timed handler latency of the packets is measured
+ */
+void showPipeline(bool shown, bool timed)
+{
+    view_pipeline = shown;
+    view_timed = timed;
+}
+
+/**
+ * @brief Render the displayed data with layout matching the screen width.
+ * 
+ */
+void renderView()
+{
+    int rows = recordRows();
+    size_t count = view_cumulative ? view_history.size() : view_records.size();
+    size_t last_first = count > (size_t)rows ? count - rows : 0;
+    view_first = std::min(view_first, last_first);
+
+    beginFrame();
+    int screen_width = frame_columns;
+    if (view_cumulative)
     {
-        printTable(records, CLEAR, 0, period);
+        printHistoryTable(view_history, screen_width, view_first, rows);
+    }
+    else if (screen_width < 16) // empty
+    {
+        printTable(view_records, CLEAR, 0, view_period, view_first, rows);
     }
     else if (screen_width < 34) // RX
     {
-        printTable(records, TX, 0, period);
+        printTable(view_records, TX, 0, view_period, view_first, rows);
     }
     else if (screen_width < 42) //  TX RX
     {
-        printTable(records, RX_TX, 0, period);
+        printTable(view_records, RX_TX, 0, view_period, view_first, rows);
     }
     else if ((screen_width - 48) / 2 < 2) //  PROTO TX RX
     {
-        printTable(records, PROTO_RX_TX, 0, period);
+        printTable(view_records, PROTO_RX_TX, 0, view_period, view_first, rows);
     }
     else // Full
     {
-        printTable(records, SRC_DST_PROTO_RX_TX, (screen_width - 48) / 2, period);
+        printTable(view_records, SRC_DST_PROTO_RX_TX, (screen_width - 48) / 2, view_period, view_first, rows);
+    }
+    printCaptureStats(view_capture);
+    if (view_pipeline)
+        printPipeline(view_capture, 3 + rows, view_timed);
+    flushFrame();
+}
+
+/**
+ * @brief Update ncurses view with table.
+ * 
+ * @param records top communicating flows
+ * @param capture capture counters of the period
+ * @param period capture period
+ */
+void updateView(const FlowSnapshot &records, const CaptureStats &capture, unsigned int period)
+{
+    view_records.assign(records.begin(), records.end());
+    view_capture = capture;
+    view_period = period;
+    view_cumulative = false;
+    renderView();
+}
+
+/**
+ * @brief Update ncurses view with table of flows kept across periods.
+ * 
+ * @param records top flows with their history
+ * @param capture capture counters of the period
+ */
+void updateHistoryView(const HistorySnapshot &records, const CaptureStats &capture)
+{
+    view_history.assign(records.begin(), records.end());
+    view_capture = capture;
+    view_cumulative = true;
+    renderView();
+}
+
+/**
+ * @brief Move the displayed page according to the pressed key.
+ * 
+ * @param key 
+ * @return true if the view has to be rendered again
+ */
+bool scrollView(int key)
+{
+    size_t page = std::max(recordRows(), 1);
+    switch (key)
+    {
+    case KEY_DOWN:
+    case 'j':
+        view_first++;
+        return true;
+    case KEY_UP:
+    case 'k':
+        view_first -= std::min(view_first, (size_t)1);
+        return true;
+    case KEY_NPAGE:
+    case ' ':
+        view_first += page;
+        return true;
+    case KEY_PPAGE:
+    case 'b':
+        view_first -= std::min(view_first, page);
+        return true;
+    case KEY_HOME:
+    case 'g':
+        view_first = 0;
+        return true;
+    case KEY_END:
+    case 'G':
+        view_first = view_cumulative ? view_history.size() : view_records.size(); // clamped when rendered
+        return true;
+    case 'i':
+        view_pipeline = !view_pipeline;
+        return true;
+    case KEY_RESIZE:
+        return true;
+    default:
+        return false;
+    }
+}
+
+/**
+ * @brief Handle paging keys until the end of the period or until running is cleared.
+ * 
+ * Keys are waited for in slices of INPUT_POLL_MS, so an interrupted program exits without
+ * waiting for the end of the period.
+ * 
+ * @param period capture period
+ * @param running cleared by the signal handler
+ */
+void waitForInput(unsigned int period, const volatile std::sig_atomic_t &running)
+{
+    std::chrono::steady_clock::time_point deadline = std::chrono::steady_clock::now() + std::chrono::seconds(period);
+    while (running)
+    {
+        long long remaining = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - std::chrono::steady_clock::now()).count();
+        if (remaining <= 0)
+            return;
+
+        timeout((int)std::min(remaining, (long long)INPUT_POLL_MS));
+        int key = getch();
+        if (key != ERR && scrollView(key))
+            renderView();
     }
-    refresh();
 }
 
 /**
@@ -273,6 +711,8 @@ int startUI()
 {
     initscr();
     noecho();
+    cbreak();
+    keypad(stdscr, TRUE);
     curs_set(0);
 
     return 0;
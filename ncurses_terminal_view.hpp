@@ -9,12 +9,23 @@
 #ifndef NCURSES_TERMINAL_VIEW_HPP
 #define NCURSES_TERMINAL_VIEW_HPP
 
-#include <list>
+#include <string>
+#include <csignal>
 #include "flow_table.hpp"
+#include "capturing_utils.hpp"
+#include "flow_store.hpp"
+#include "export_writer.hpp"
 
 int  startUI();
-void updateView(std::list<std::pair<FlowKey, FlowStats>> data, unsigned int period);
-void writeWindowToFile(const std::string &filename);
+void updateView(const FlowSnapshot &data, const CaptureStats &capture, unsigned int period);
+void updateHistoryView(const HistorySnapshot &data, const CaptureStats &capture);
+void waitForInput(unsigned int period, const volatile std::sig_atomic_t &running);
+void showPipeline(bool shown, bool timed);
+void writeWindowToFile(ExportWriter &writer);
 int  stopUI();
 
+#define MAGNITUDE_FORMAT_SIZE 8 // 999.9K and the terminator
+
+const char *toOrderOfMagnitudeFormat(double bandwidth, char *text);
+
 #endif
\ No newline at end of file
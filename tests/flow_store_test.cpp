@@ -0,0 +1,243 @@
+/**
+ * @file flow_store_test.cpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Cumulative flow store keeps totals and averages, expires idle flows and stays within its capacity.
+ *
+ * Erasing from the flow hash table is checked against std::unordered_map on random operations,
+ * the store is checked on small scripted scenarios with idle timeouts of both timing wheel levels
+ * and on a flood of short flows far above its capacity.
+ *
+ * Usage: flow_store_test
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <netinet/in.h>
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <random>
+#include <unordered_map>
+#include <cstdint>
+
+#include "../flow_table.hpp"
+#include "../flow_store.hpp"
+#include "test_utils.hpp"
+
+#define FLOOD_FLOWS 100000
+#define FLOOD_CAPACITY 1000
+
+/**
+ * @brief Canonical key of n-th synthetic UDP flow.
+ *
+ * @param n
+ * @return FlowKey
+ */
+FlowKey flowKey(uint32_t n)
+{
+    IpAddress src = {};
+    IpAddress dst = {};
+    src.bytes[0] = 10;
+    src.bytes[1] = (n >> 16) & 0xff;
+    src.bytes[2] = (n >> 8) & 0xff;
+    src.bytes[3] = n & 0xff;
+    dst.bytes[0] = 192;
+    dst.bytes[1] = 168;
+    FlowKey key(src, 40000 + (n % 1000), dst, 53, IPPROTO_UDP, IpAddrClass::IPV4);
+    key.canonicalize();
+    return key;
+}
+
+/**
+ * @brief Statistics of one period with tx_packets packets of bytes octets each.
+ *
+ */
+FlowEntry periodEntry(bool reversed, unsigned long long rx_packets, unsigned long long tx_packets, unsigned long long bytes)
+{
+    FlowEntry entry(reversed);
+    entry.stats = FlowStats(rx_packets * bytes, rx_packets, tx_packets * bytes, tx_packets);
+    return entry;
+}
+
+/**
+ * @brief Check if the flow is kept by the store.
+ *
+ */
+bool isStored(FlowStore &store, uint32_t n)
+{
+    FlowKey key = flowKey(n);
+    HistorySnapshot records;
+    store.getStatistics(records, SortKey::BYTES, store.size());
+    for (const std::pair<FlowKey, FlowHistory> &record : records)
+    {
+        FlowKey canonical = record.first;
+        canonical.canonicalize();
+        if (canonical == key)
+            return true;
+    }
+    return false;
+}
+
+/**
+ * @brief Random inserts and erases agree with std::unordered_map.
+ *
+ */
+bool checkErase()
+{
+    FlowHashTable<FlowKey, uint32_t, FlowKeyHash> table(512);
+    std::unordered_map<FlowKey, uint32_t, FlowKeyHash> reference;
+    std::mt19937 random(1);
+
+    for (uint32_t operation = 0; operation < 200000; operation++)
+    {
+        uint32_t n = random() % 1500;
+        FlowKey key = flowKey(n);
+        if (random() % 2 == 0 && reference.size() < 512)
+        {
+            table.findOrInsert(key, n);
+            reference.insert({key, n});
+        }
+        else if (table.erase(key) != (reference.erase(key) == 1))
+        {
+            return false;
+        }
+    }
+
+    if (table.usedCount() != reference.size())
+        return false;
+    for (size_t i = 0; i < table.usedCount(); i++)
+    {
+        if (reference.count(table.usedSlot(i).key) == 0)
+            return false;
+    }
+    for (uint32_t n = 0; n < 1500; n++)
+    {
+        uint32_t *value = table.find(flowKey(n));
+        bool present = reference.count(flowKey(n)) == 1;
+        if ((value != nullptr) != present || (present && *value != n))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Totals are summed over periods in the direction of the first packet.
+ *
+ */
+bool checkTotals()
+{
+    FlowStore store(16, 10, 1);
+    for (int period = 0; period < 5; period++)
+    {
+        // First packet of the odd periods goes the other way, so their rx and tx are swapped
+        bool reversed = period % 2 == 1;
+        store.add(flowKey(1), reversed ? periodEntry(true, 2, 1, 100) : periodEntry(false, 1, 2, 100));
+        store.advance();
+    }
+
+    HistorySnapshot records;
+    store.getStatistics(records, SortKey::BYTES, 10);
+    if (records.size() != 1)
+        return false;
+    const FlowStats &total = records.front().second.total;
+    return total.tx_packets == 10 && total.rx_packets == 5 && total.tx_bytes == 1000 && total.rx_bytes == 500;
+}
+
+/**
+ * @brief Window averages and peak of a flow sending 1000 B per period for 5 periods.
+ *
+ * @param period period length in seconds
+ * @param expected b/s of the windows and the peak after 5 busy and 1 silent period
+ */
+bool checkWindows(unsigned int period, const double (&expected)[RATE_WINDOWS + 1])
+{
+    FlowStore store(16, 100, period);
+    for (int i = 0; i < 6; i++)
+    {
+        if (i < 5)
+            store.add(flowKey(1), periodEntry(false, 4, 6, 100));
+        store.advance();
+    }
+
+    HistorySnapshot records;
+    store.getStatistics(records, SortKey::BYTES, 1);
+    const FlowHistory &history = records.front().second;
+    for (size_t i = 0; i < RATE_WINDOWS; i++)
+    {
+        if (history.window_rates[i] != expected[i])
+            return false;
+    }
+    return history.peak_rate == expected[RATE_WINDOWS];
+}
+
+/**
+ * @brief Flow expires exactly after idle_periods periods without packets.
+ *
+ * @param idle_periods
+ */
+bool checkExpiry(unsigned int idle_periods)
+{
+    FlowStore store(16, idle_periods, 1);
+    // Steady flow 2 is seen in every period, flow 1 only in the first one
+    store.add(flowKey(1), periodEntry(false, 1, 1, 100));
+    for (unsigned int period = 0; period < idle_periods + 3 * WHEEL_SLOTS; period++)
+    {
+        store.add(flowKey(2), periodEntry(false, 1, 1, 100));
+        store.advance();
+        bool expected = period < idle_periods;
+        if (isStored(store, 1) != expected || !isStored(store, 2))
+            return false;
+    }
+    return store.expiredCount() == 1;
+}
+
+/**
+ * @brief Full store evicts the least recently seen flow.
+ *
+ */
+bool checkEviction()
+{
+    FlowStore store(4, 100, 1);
+    for (uint32_t n = 1; n <= 4; n++)
+    {
+        store.add(flowKey(n), periodEntry(false, 1, 1, 100));
+        store.advance();
+    }
+    store.add(flowKey(1), periodEntry(false, 1, 1, 100)); // 2 is the least recently seen now
+    store.add(flowKey(5), periodEntry(false, 1, 1, 100));
+    store.advance();
+    return store.evictedCount() == 1 && !isStored(store, 2) && isStored(store, 1) && isStored(store, 5);
+}
+
+/**
+ * @brief Flood of short flows does not grow the store beyond its capacity.
+ *
+ */
+bool checkFlood()
+{
+    FlowStore store(FLOOD_CAPACITY, 60, 1);
+    for (uint32_t n = 0; n < FLOOD_FLOWS; n++)
+    {
+        store.add(flowKey(n), periodEntry(false, 0, 1, 60));
+        if (n % 1000 == 999)
+            store.advance();
+    }
+    return store.size() == FLOOD_CAPACITY && store.evictedCount() == FLOOD_FLOWS - FLOOD_CAPACITY;
+}
+
+int main()
+{
+    bool ok = true;
+    ok &= check("hash table erase", checkErase());
+    ok &= check("cumulative totals", checkTotals());
+    ok &= check("2s/10s/40s averages", checkWindows(1, {8000 / 2.0, 5 * 8000 / 10.0, 5 * 8000 / 40.0, 8000}));
+    ok &= check("averages with 2s period", checkWindows(2, {0, 4 * 8000 / 10.0, 5 * 8000 / 40.0, 4000}));
+    ok &= check("expiry in level 0", checkExpiry(5));
+    ok &= check("expiry in level 1", checkExpiry(3 * WHEEL_SLOTS + 7));
+    ok &= check("expiry beyond level 1", checkExpiry(WHEEL_SLOTS * WHEEL_SLOTS + 70));
+    ok &= check("least recently seen eviction", checkEviction());
+    ok &= check("bounded flood", checkFlood());
+    return ok ? 0 : 1;
+}
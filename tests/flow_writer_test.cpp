@@ -0,0 +1,191 @@
+/**
+ * @file flow_writer_test.cpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Headless records carry exact counters in the documented JSON Lines and CSV layouts.
+ *
+ * Snapshots with IPv4 and IPv6 flows are written into a temporary file and compared with
+ * the expected text, CSV header must be written only into an empty file. Rotated files
+ * must each start with the header and keep every record.
+ *
+ * Usage: flow_writer_test
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+
+#include "../flow_table.hpp"
+#include "../flow_store.hpp"
+#include "../flow_writer.hpp"
+#include "test_utils.hpp"
+
+/**
+ * @brief Snapshot with an IPv4 UDP flow and an IPv6 ICMPv6 flow with counters beyond 32 bits.
+ *
+ */
+FlowSnapshot sampleSnapshot()
+{
+    IpAddress src = {}, dst = {};
+    inet_pton(AF_INET, "10.0.0.1", src.bytes);
+    inet_pton(AF_INET, "192.168.1.1", dst.bytes);
+    FlowSnapshot snapshot;
+    snapshot.push_back({FlowKey(src, 40000, dst, 53, IPPROTO_UDP, IpAddrClass::IPV4), FlowStats(5000000000ULL, 4000000, 120, 2)});
+
+    inet_pton(AF_INET6, "2001:db8::1", src.bytes);
+    inet_pton(AF_INET6, "fe80::2", dst.bytes);
+    snapshot.push_back({FlowKey(src, 0, dst, 0, IPPROTO_ICMPV6, IpAddrClass::IPV6), FlowStats(64, 1, 0, 0)});
+    return snapshot;
+}
+
+/**
+ * @brief Content of the file.
+ *
+ */
+std::string readFile(const std::string &path)
+{
+    std::ifstream file(path);
+    std::stringstream content;
+    content << file.rdbuf();
+    return content.str();
+}
+
+/**
+ * @brief Write the sample snapshot twice, the second time by another writer appending to the file.
+ *
+ */
+std::string writeSample(OutputFormat format, const std::string &path)
+{
+    std::remove(path.c_str());
+    {
+        FlowWriter writer(format, false, path.c_str(), ExportOptions());
+        writer.writePeriod(1700000001000LL, 1, sampleSnapshot());
+    }
+    {
+        FlowWriter writer(format, false, path.c_str(), ExportOptions());
+        writer.writePeriod(1700000002000LL, 1, FlowSnapshot(1, sampleSnapshot()[1]));
+    }
+    std::string content = readFile(path);
+    std::remove(path.c_str());
+    return content;
+}
+
+/**
+ * @brief Cumulative records carry totals and averaged bandwidths.
+ *
+ */
+std::string writeHistorySample(OutputFormat format, const std::string &path)
+{
+    FlowHistory history;
+    history.total = FlowStats(300, 3, 100, 1);
+    history.window_rates[0] = 1600;
+    history.window_rates[1] = 320;
+    history.window_rates[2] = 80;
+    history.peak_rate = 2400.5;
+    HistorySnapshot records(1, {sampleSnapshot()[0].first, history});
+
+    std::remove(path.c_str());
+    {
+        FlowWriter writer(format, true, path.c_str(), ExportOptions());
+        writer.writeHistory(1700000003000LL, records);
+    }
+    std::string content = readFile(path);
+    std::remove(path.c_str());
+    return content;
+}
+
+/**
+ * @brief Write three periods with rotation after every period, return contents of all files.
+ *
+ */
+std::vector<std::string> writeRotated(const std::string &directory)
+{
+    mkdir(directory.c_str(), 0755);
+    ExportOptions options;
+    options.rotate_size = 200; // header and one period
+    {
+        FlowWriter writer(OutputFormat::CSV, false, (directory + "/records.csv").c_str(), options);
+        for (int i = 1; i <= 3; i++)
+            writer.writePeriod(1700000000000LL + i * 1000, 1, sampleSnapshot());
+    }
+
+    std::vector<std::string> contents;
+    DIR *dir = opendir(directory.c_str());
+    for (struct dirent *entry = readdir(dir); entry != nullptr; entry = readdir(dir))
+    {
+        std::string name = entry->d_name;
+        if (name == "." || name == "..")
+            continue;
+        contents.push_back(readFile(directory + "/" + name));
+        std::remove((directory + "/" + name).c_str());
+    }
+    closedir(dir);
+    rmdir(directory.c_str());
+    return contents;
+}
+
+/**
+ * @brief Every rotated file holds the header and one period, no record is lost.
+ *
+ */
+bool checkRotated(const std::string &directory)
+{
+    const std::string header = "time_ms,period,rank,src,src_port,dst,dst_port,protocol,rx_bytes,rx_packets,tx_bytes,tx_packets\n";
+    std::vector<std::string> contents = writeRotated(directory);
+    std::vector<std::string> times; // time of the period in each file
+    bool ok = contents.size() == 3;
+    for (const std::string &content : contents)
+    {
+        ok &= content.compare(0, header.size(), header) == 0 && std::count(content.begin(), content.end(), '\n') == 3;
+        times.push_back(content.substr(header.size(), 13));
+    }
+    std::sort(times.begin(), times.end());
+    ok &= times == std::vector<std::string>({"1700000001000", "1700000002000", "1700000003000"});
+    std::cout << "rotation" << (ok ? " OK" : " FAIL") << std::endl;
+    return ok;
+}
+
+int main()
+{
+    std::string path = "/tmp/flow_writer_test." + std::to_string(getpid());
+    bool ok = true;
+
+    ok &= checkText("jsonl", writeSample(OutputFormat::JSONL, path),
+                    "{\"time_ms\":1700000001000,\"period\":1,\"rank\":1,\"src\":\"10.0.0.1\",\"src_port\":40000,\"dst\":\"192.168.1.1\",\"dst_port\":53,"
+                    "\"protocol\":17,\"rx_bytes\":5000000000,\"rx_packets\":4000000,\"tx_bytes\":120,\"tx_packets\":2}\n"
+                    "{\"time_ms\":1700000001000,\"period\":1,\"rank\":2,\"src\":\"2001:db8::1\",\"src_port\":0,\"dst\":\"fe80::2\",\"dst_port\":0,"
+                    "\"protocol\":58,\"rx_bytes\":64,\"rx_packets\":1,\"tx_bytes\":0,\"tx_packets\":0}\n"
+                    "{\"time_ms\":1700000002000,\"period\":1,\"rank\":1,\"src\":\"2001:db8::1\",\"src_port\":0,\"dst\":\"fe80::2\",\"dst_port\":0,"
+                    "\"protocol\":58,\"rx_bytes\":64,\"rx_packets\":1,\"tx_bytes\":0,\"tx_packets\":0}\n");
+
+    ok &= checkText("csv", writeSample(OutputFormat::CSV, path),
+                    "time_ms,period,rank,src,src_port,dst,dst_port,protocol,rx_bytes,rx_packets,tx_bytes,tx_packets\n"
+                    "1700000001000,1,1,10.0.0.1,40000,192.168.1.1,53,17,5000000000,4000000,120,2\n"
+                    "1700000001000,1,2,2001:db8::1,0,fe80::2,0,58,64,1,0,0\n"
+                    "1700000002000,1,1,2001:db8::1,0,fe80::2,0,58,64,1,0,0\n");
+
+    ok &= checkText("cumulative jsonl", writeHistorySample(OutputFormat::JSONL, path),
+                    "{\"time_ms\":1700000003000,\"rank\":1,\"src\":\"10.0.0.1\",\"src_port\":40000,\"dst\":\"192.168.1.1\",\"dst_port\":53,"
+                    "\"protocol\":17,\"rx_bytes\":300,\"rx_packets\":3,\"tx_bytes\":100,\"tx_packets\":1,"
+                    "\"rate_2s\":1600.000,\"rate_10s\":320.000,\"rate_40s\":80.000,\"peak_rate\":2400.500}\n");
+
+    ok &= checkText("cumulative csv", writeHistorySample(OutputFormat::CSV, path),
+                    "time_ms,rank,src,src_port,dst,dst_port,protocol,rx_bytes,rx_packets,tx_bytes,tx_packets,rate_2s,rate_10s,rate_40s,peak_rate\n"
+                    "1700000003000,1,10.0.0.1,40000,192.168.1.1,53,17,300,3,100,1,1600.000,320.000,80.000,2400.500\n");
+
+    ok &= checkRotated(path + ".d");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+/**
+ * @file hash_distribution_test.cpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Bucket-length distribution of FlowKeyHash on synthetic scan traffic and captured flows.
+ *
+ * Keys are placed into power-of-two bucket array (load factor 0.5 - 1.0) using the low bits of the hash.
+ * Test fails if the mean successful lookup chain is far above the value expected for an ideal
+ * hash (1 + load / 2) or if any bucket chain is unreasonably long. Capture files are checked
+ * as well, but they usually hold too few flows for the mean to be meaningful.
+ *
+ * Usage: hash_distribution_test [capture.pcap ...]
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <pcap.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <unordered_set>
+#include <string>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+
+#include "../flow_table.hpp"
+#include "../capturing_utils.hpp"
+
+#define MAX_CHAIN_LIMIT 16
+#define MEAN_CHAIN_TOLERANCE 1.15
+#define MEAN_CHAIN_MIN_KEYS 1024 // mean of smaller key sets is dominated by chance
+
+/**
+ * @brief Synthetic port scan - one host probing 1024 ports on each of 256 IPv4 and 256 IPv6 hosts.
+ *
+ * @return std::vector<FlowKey> canonical keys
+ */
+std::vector<FlowKey> scanKeys()
+{
+    std::vector<FlowKey> keys;
+    IpAddress scanner4 = {};
+    IpAddress scanner6 = {};
+    inet_pton(AF_INET, "192.168.0.199", scanner4.bytes);
+    inet_pton(AF_INET6, "2a02:8308:b08d:5100::e3d1", scanner6.bytes);
+
+    for (int host = 0; host < 256; host++)
+    {
+        IpAddress target4 = {};
+        IpAddress target6 = {};
+        inet_pton(AF_INET, "10.1.0.0", target4.bytes);
+        inet_pton(AF_INET6, "2a00:1450:4014:80b::", target6.bytes);
+        target4.bytes[3] = host;
+        target6.bytes[15] = host;
+
+        for (uint16_t port = 1; port <= 1024; port++)
+        {
+            FlowKey key4(scanner4, 40000, target4, port, IPPROTO_TCP, IpAddrClass::IPV4);
+            FlowKey key6(scanner6, 40000, target6, port, IPPROTO_TCP, IpAddrClass::IPV6);
+            key4.canonicalize();
+            key6.canonicalize();
+            keys.push_back(key4);
+            keys.push_back(key6);
+        }
+    }
+    return keys;
+}
+
+/**
+ * @brief Distinct canonical flow keys found in the capture file.
+ *
+ * @param file pcap file
+ * @return std::vector<FlowKey>
+ */
+std::vector<FlowKey> captureKeys(const char *file)
+{
+    char error_buffer[PCAP_ERRBUF_SIZE];
+    pcap_t *handle = pcap_open_offline(file, error_buffer);
+    if (handle == nullptr)
+    {
+        throw std::invalid_argument(error_buffer);
+    }
+
+    PacketDecoder decode = decoderForLinkType(pcap_datalink(handle));
+    if (decode == nullptr)
+    {
+        pcap_close(handle);
+        throw std::invalid_argument(std::string(file) + ": Unsupported link type");
+    }
+
+    std::unordered_set<FlowKey, FlowKeyHash> unique;
+    struct pcap_pkthdr *packet_header;
+    const u_char *packet;
+    while (pcap_next_ex(handle, &packet_header, &packet) == 1)
+    {
+        FlowRecord record;
+        if (decode(packet_header, packet, record) == DecodeStatus::VALID)
+        {
+            record.key.canonicalize();
+            unique.insert(record.key);
+        }
+    }
+    pcap_close(handle);
+    return std::vector<FlowKey>(unique.begin(), unique.end());
+}
+
+/**
+ * @brief Print bucket-length histogram of the keys and check it against ideal hash.
+ *
+ * @param name name of the key set
+ * @param keys
+ * @param hash
+ * @return true if distribution is acceptable
+ */
+bool checkDistribution(const std::string &name, const std::vector<FlowKey> &keys, const FlowKeyHash &hash)
+{
+    size_t buckets = 1;
+    while (buckets < keys.size())
+        buckets <<= 1;
+
+    std::vector<unsigned> lengths(buckets, 0);
+    for (const FlowKey &key : keys)
+        lengths[hash(key) & (buckets - 1)]++;
+
+    std::vector<unsigned> histogram;
+    double probes = 0;
+    unsigned max_chain = 0;
+    for (unsigned length : lengths)
+    {
+        if (length >= histogram.size())
+            histogram.resize(length + 1, 0);
+        histogram[length]++;
+        probes += length * (length + 1) / 2.0;
+        max_chain = std::max(max_chain, length);
+    }
+
+    double load = (double)keys.size() / buckets;
+    double mean = keys.empty() ? 0 : probes / keys.size();
+    double expected = 1 + load / 2;
+    bool ok = max_chain <= MAX_CHAIN_LIMIT &&
+              (keys.size() < MEAN_CHAIN_MIN_KEYS || mean <= expected * MEAN_CHAIN_TOLERANCE);
+
+    std::cout << "==========================" << name << "=============================" << std::endl;
+    std::cout << "keys=" << keys.size() << " buckets=" << buckets << " load=" << std::fixed << std::setprecision(2) << load << std::endl;
+    for (size_t length = 0; length < histogram.size(); length++)
+        std::cout << "  length " << std::setw(2) << length << ": " << histogram[length] << std::endl;
+    std::cout << "max_chain=" << max_chain << " mean_chain=" << mean << " expected=" << expected
+              << (ok ? " OK" : " FAIL") << std::endl;
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    bool ok = true;
+    // Fixed seeds keep the run reproducible, default hasher uses the startup seed
+    std::vector<FlowKeyHash> hashes = {FlowKeyHash(0), FlowKeyHash(0x5bd1e995ULL), FlowKeyHash()};
+
+    std::vector<FlowKey> scan = scanKeys();
+    for (size_t i = 0; i < hashes.size(); i++)
+        ok &= checkDistribution("scan seed " + std::to_string(i), scan, hashes[i]);
+
+    for (int i = 1; i < argc; i++)
+    {
+        try
+        {
+            std::vector<FlowKey> keys = captureKeys(argv[i]);
+            for (size_t j = 0; j < hashes.size(); j++)
+                ok &= checkDistribution(std::string(argv[i]) + " seed " + std::to_string(j), keys, hashes[j]);
+        }
+        catch (const std::exception &ex)
+        {
+            std::cerr << "Error: " << ex.what() << std::endl;
+            return 1;
+        }
+    }
+
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,394 @@
+/**
+ * @file hot_path_bench.cpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Microbenchmarks of the packet processing hot path.
+ *
+ * Measures packet_handler on synthetic frames, flow table updates with uniform and Zipf
+ * distributed keys, snapshot of the top flows and bandwidth formatting. Every benchmark
+ * prints time and number of heap allocations per operation, allocations are counted by
+ * replacing the global operator new.
+ *
+ * Flow tables are allocated for at most BENCH_MAX_TABLE_FLOWS flows. Key spaces above the
+ * limit are named by the number of keys and the table size, they measure a table which fills
+ * up and then rejects new flows, inserted and rejected records are reported below them.
+ *
+ * Usage: hot_path_bench
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <pcap.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <random>
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <new>
+
+#include "../flow_table.hpp"
+#include "../capturing_utils.hpp"
+#include "../ncurses_terminal_view.hpp"
+
+#define BENCH_MAX_TABLE_FLOWS (1 << 20)
+#define BENCH_TABLE_OPS 4000000
+#define BENCH_HANDLER_OPS 4000000
+#define BENCH_HANDLER_FLOWS 1024 // per frame type
+#define BENCH_SNAPSHOTS 20
+#define BENCH_FORMAT_OPS 1000000
+#define ZIPF_EXPONENT 1.0
+#define BENCH_NAME_WIDTH 56
+
+static unsigned long long allocations = 0;
+
+void *operator new(std::size_t size)
+{
+    allocations++;
+    void *p = std::malloc(size ? size : 1);
+    if (p == nullptr)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void *operator new[](std::size_t size)
+{
+    return operator new(size);
+}
+
+void operator delete[](void *p) noexcept
+{
+    operator delete(p);
+}
+
+static volatile unsigned long long sink; // keeps results of the measured code alive
+
+/**
+ * @brief Time and allocations of a measured run.
+ *
+ */
+class Measurement
+{
+public:
+    Measurement() : begin(std::chrono::steady_clock::now()), begin_allocations(allocations) {}
+
+    /**
+     * @brief Print ns/op and allocations/op of the run.
+     *
+     * @param name benchmark name
+     * @param ops number of operations
+     */
+    void report(const std::string &name, unsigned long long ops)
+    {
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+        unsigned long long allocated = allocations - begin_allocations;
+        std::cout << std::left << std::setw(BENCH_NAME_WIDTH) << name << std::right
+                  << std::setw(12) << ops
+                  << std::setw(12) << std::fixed << std::setprecision(1) << ns / ops
+                  << std::setw(14) << std::setprecision(3) << (double)allocated / ops << std::endl;
+    }
+
+private:
+    std::chrono::steady_clock::time_point begin;
+    unsigned long long begin_allocations;
+};
+
+/**
+ * @brief Ethernet frame with IPv4 or IPv6 packet of the flow.
+ *
+ * @param flow flow number, selects source address and port
+ * @param ipv6
+ * @param protocol IPPROTO_TCP, IPPROTO_UDP, IPPROTO_ICMP or IPPROTO_ICMPV6
+ * @return std::vector<u_char>
+ */
+std::vector<u_char> syntheticFrame(uint32_t flow, bool ipv6, uint8_t protocol)
+{
+    const size_t ip_size = ipv6 ? 40 : 20;
+    const size_t l4_size = protocol == IPPROTO_TCP ? 20 : 8;
+    std::vector<u_char> frame(14 + ip_size + l4_size + 64, 0);
+
+    frame[12] = ipv6 ? 0x86 : 0x08; // ethertype
+    frame[13] = ipv6 ? 0xdd : 0x00;
+    u_char *ip = &frame[14];
+    uint16_t payload = l4_size + 64;
+    if (ipv6)
+    {
+        ip[0] = 0x60;
+        ip[4] = payload >> 8;
+        ip[5] = payload & 0xff;
+        ip[6] = protocol;
+        ip[8] = 0x20;
+        ip[9] = 0x01;
+        ip[21] = flow >> 16;
+        ip[22] = flow >> 8;
+        ip[23] = flow;
+        ip[24] = 0x20;
+        ip[25] = 0x01;
+        ip[39] = 0x01;
+    }
+    else
+    {
+        uint16_t total = ip_size + payload;
+        ip[0] = 0x45;
+        ip[2] = total >> 8;
+        ip[3] = total & 0xff;
+        ip[9] = protocol;
+        ip[12] = 10;
+        ip[13] = flow >> 16;
+        ip[14] = flow >> 8;
+        ip[15] = flow;
+        ip[16] = 10;
+        ip[17] = 255;
+        ip[19] = 1;
+    }
+
+    u_char *l4 = ip + ip_size;
+    uint16_t port = 1024 + (flow & 0x7fff);
+    l4[0] = port >> 8;
+    l4[1] = port & 0xff;
+    l4[3] = 80;
+    return frame;
+}
+
+/**
+ * @brief packet_handler on interleaved IPv4/IPv6 TCP/UDP/ICMP frames of BENCH_HANDLER_FLOWS flows each.
+ *
+ */
+void benchPacketHandler()
+{
+    struct FrameType
+    {
+        bool ipv6;
+        uint8_t protocol;
+    };
+    const FrameType types[] = {{false, IPPROTO_TCP}, {false, IPPROTO_UDP}, {false, IPPROTO_ICMP},
+                               {true, IPPROTO_TCP}, {true, IPPROTO_UDP}, {true, IPPROTO_ICMPV6}};
+
+    std::vector<std::vector<u_char>> frames;
+    for (uint32_t flow = 0; flow < BENCH_HANDLER_FLOWS; flow++)
+        for (const FrameType &type : types)
+            frames.push_back(syntheticFrame(flow, type.ipv6, type.protocol));
+
+    std::vector<struct pcap_pkthdr> headers(frames.size());
+    for (size_t i = 0; i < frames.size(); i++)
+        headers[i].caplen = headers[i].len = frames[i].size();
+
+    FlowTable table(BENCH_MAX_TABLE_FLOWS);
+    CaptureContext context(&table, decodeEthernet, nullptr, false);
+
+    Measurement measurement;
+    for (uint32_t n = 0; n < BENCH_HANDLER_OPS; n++)
+    {
+        size_t i = (n * 7919u) % frames.size(); // spread consecutive packets over flows
+        packet_handler((u_char *)&context, &headers[i], frames[i].data());
+    }
+    flushCaptureBatch(&context);
+    measurement.report("packet_handler ipv4/ipv6 tcp/udp/icmp", BENCH_HANDLER_OPS);
+    FlowSnapshot snapshot;
+    table.getStatistics(snapshot);
+    sink = snapshot.size();
+}
+
+/**
+ * @brief IPv4 TCP key of the flow number.
+ *
+ * @param flow
+ * @return FlowKey
+ */
+static inline FlowKey flowKey(uint32_t flow)
+{
+    IpAddress src = {};
+    IpAddress dst = {};
+    src.words[0] = htonl(0x0a000000 + flow);
+    dst.words[0] = htonl(0xc0a80001);
+    return FlowKey(src, 1024 + (flow & 0x7fff), dst, 443, IPPROTO_TCP, IpAddrClass::IPV4);
+}
+
+/**
+ * @brief Sequence of flow numbers drawn uniformly or from Zipf distribution over the key space.
+ *
+ * @param flows size of the key space
+ * @param zipf draw from Zipf distribution (flow 0 is the most frequent one)
+ * @param count length of the sequence
+ * @return std::vector<uint32_t>
+ */
+std::vector<uint32_t> flowSequence(uint32_t flows, bool zipf, size_t count)
+{
+    std::mt19937_64 generator(42);
+    std::vector<uint32_t> sequence(count);
+
+    if (!zipf)
+    {
+        std::uniform_int_distribution<uint32_t> uniform(0, flows - 1);
+        for (uint32_t &flow : sequence)
+            flow = uniform(generator);
+        return sequence;
+    }
+
+    std::vector<double> cdf(flows);
+    double sum = 0;
+    for (uint32_t rank = 0; rank < flows; rank++)
+    {
+        sum += 1.0 / std::pow(rank + 1.0, ZIPF_EXPONENT);
+        cdf[rank] = sum;
+    }
+    std::uniform_real_distribution<double> uniform(0, sum);
+    for (uint32_t &flow : sequence)
+        flow = std::min<size_t>(std::upper_bound(cdf.begin(), cdf.end(), uniform(generator)) - cdf.begin(), flows - 1);
+    return sequence;
+}
+
+/**
+ * @brief Print records of the measured run inserted into the table and rejected by the full table.
+ *
+ * @param table table after the snapshot of the run
+ */
+void reportCounters(FlowTable &table)
+{
+    FlowTableCounters counters = table.getCounters();
+    std::cout << "  inserted " << counters.inserted << " rejected " << counters.rejected << std::endl;
+}
+
+/**
+ * @brief FlowTable::addOrUpdateRecord and addOrUpdateBatch over the key space.
+ *
+ * @param flows size of the key space
+ * @param zipf Zipf distributed keys instead of uniform
+ */
+void benchTableUpdates(uint32_t flows, bool zipf)
+{
+    std::vector<uint32_t> sequence = flowSequence(flows, zipf, BENCH_TABLE_OPS);
+    size_t max_flows = std::min<size_t>(flows, BENCH_MAX_TABLE_FLOWS);
+    std::string name = std::string(zipf ? "zipf" : "uniform");
+    if (max_flows < flows)
+        name += " keys=" + std::to_string(flows) + " table=" + std::to_string(max_flows);
+    else
+        name += " flows=" + std::to_string(flows);
+
+    {
+        FlowTable table(max_flows);
+        Measurement measurement;
+        for (uint32_t flow : sequence)
+            table.addOrUpdateRecord(flowKey(flow), 100);
+        measurement.report("addOrUpdateRecord " + name, sequence.size());
+        FlowSnapshot snapshot;
+        table.getStatistics(snapshot);
+        sink = snapshot.size();
+        if (max_flows < flows)
+            reportCounters(table);
+    }
+
+    {
+        FlowTable table(max_flows);
+        FlowRecord batch[FLOW_BATCH_SIZE];
+        size_t batched = 0;
+        Measurement measurement;
+        for (uint32_t flow : sequence)
+        {
+            batch[batched].key = flowKey(flow);
+            batch[batched].bytes = 100;
+            if (++batched == FLOW_BATCH_SIZE)
+            {
+                table.addOrUpdateBatch(batch, batched);
+                batched = 0;
+            }
+        }
+        table.addOrUpdateBatch(batch, batched);
+        measurement.report("addOrUpdateBatch  " + name, sequence.size());
+        FlowSnapshot snapshot;
+        table.getStatistics(snapshot);
+        sink = snapshot.size();
+        if (max_flows < flows)
+            reportCounters(table);
+    }
+}
+
+/**
+ * @brief FlowTable::getStatistics of a period with given number of flows.
+ *
+ * Table is filled before every snapshot, only the snapshot is measured. The snapshot is
+ * reused like in FlowMonitor::getData, so only the first one allocates.
+ *
+ * @param flows number of flows in the period
+ * @param top_flows number of reported flows
+ */
+void benchSnapshot(uint32_t flows, size_t top_flows)
+{
+    FlowTable table(flows);
+    table.setTopFlows(top_flows);
+    FlowSnapshot snapshot;
+
+    double ns = 0;
+    unsigned long long allocated = 0;
+    for (int period = 0; period < BENCH_SNAPSHOTS; period++)
+    {
+        for (uint32_t flow = 0; flow < flows; flow++)
+            table.addOrUpdateRecord(flowKey(flow), 100 + (flow * 2654435761u) % 1500);
+
+        unsigned long long begin_allocations = allocations;
+        std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+        snapshot.clear();
+        table.getStatistics(snapshot);
+        sink = snapshot.size();
+        ns += std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - begin).count();
+        allocated += allocations - begin_allocations;
+    }
+
+    std::string name = "getStatistics flows=" + std::to_string(flows) + " top=" + std::to_string(top_flows);
+    std::cout << std::left << std::setw(BENCH_NAME_WIDTH) << name << std::right
+              << std::setw(12) << BENCH_SNAPSHOTS
+              << std::setw(12) << std::fixed << std::setprecision(1) << ns / BENCH_SNAPSHOTS
+              << std::setw(14) << std::setprecision(3) << (double)allocated / BENCH_SNAPSHOTS << std::endl;
+}
+
+/**
+ * @brief toOrderOfMagnitudeFormat over values of all orders of magnitude.
+ *
+ */
+void benchFormat()
+{
+    const double values[] = {0.04, 7.0, 56.3, 999.9, 1234.0, 45678.9, 8.5e6, 1.2e9, 3.4e12, 9.9e15};
+    const size_t count = sizeof(values) / sizeof(values[0]);
+
+    unsigned long long length = 0;
+    char text[MAGNITUDE_FORMAT_SIZE];
+    Measurement measurement;
+    for (size_t n = 0; n < BENCH_FORMAT_OPS; n++)
+        length += strlen(toOrderOfMagnitudeFormat(values[n % count], text));
+    measurement.report("toOrderOfMagnitudeFormat", BENCH_FORMAT_OPS);
+    sink = length;
+}
+
+int main()
+{
+    std::cout << std::left << std::setw(BENCH_NAME_WIDTH) << "benchmark" << std::right
+              << std::setw(12) << "ops" << std::setw(12) << "ns/op" << std::setw(14) << "allocs/op" << std::endl;
+
+    benchPacketHandler();
+
+    for (uint32_t flows : {1000u, 100000u, 10000000u})
+    {
+        benchTableUpdates(flows, false);
+        benchTableUpdates(flows, true);
+    }
+
+    benchSnapshot(1000, 10);
+    benchSnapshot(100000, 10);
+    benchSnapshot(100000, 1000);
+
+    benchFormat();
+    return 0;
+}
@@ -0,0 +1,91 @@
+import subprocess
+import socket
+import threading
+from typing import Optional, Sequence
+import sys
+import os
+import time
+
+# Checks that with multiple capture threads (-j) both directions of every flow
+# are accounted in one row, i.e. PACKET_FANOUT keeps a flow on a single worker.
+
+SERVER_PORT = 45678
+CONNECTIONS = 32
+DURATION = 4 # seconds
+
+def serve(server):
+    while True:
+        try:
+            conn, _ = server.accept()
+        except OSError:
+            return
+        threading.Thread(target=echo, args=(conn,), daemon=True).start()
+
+def echo(conn):
+    with conn:
+        while True:
+            data = conn.recv(4096)
+            if not data:
+                return
+            conn.sendall(data)
+
+def client(ports):
+    with socket.create_connection(("127.0.0.1", SERVER_PORT)) as conn:
+        ports.append(conn.getsockname()[1])
+        end = time.time() + DURATION
+        while time.time() < end:
+            conn.sendall(b"x" * 1024)
+            conn.recv(4096)
+            time.sleep(0.01)
+
+def main(argv: Optional[Sequence[str]] = None) -> int:
+    threads = argv[1] if len(argv) > 1 else "4"
+    out_dir = f"./test_results/fanout_{threads}"
+    os.makedirs(out_dir, exist_ok=True)
+
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    server.bind(("127.0.0.1", SERVER_PORT))
+    server.listen()
+    threading.Thread(target=serve, args=(server,), daemon=True).start()
+
+    isatop = subprocess.Popen(["sudo", "../isa-top", "-i", "lo", "-j", threads, "-n", "100", "-t", "1", "-d", out_dir])
+    time.sleep(1)
+
+    ports = []
+    clients = [threading.Thread(target=client, args=(ports,)) for _ in range(CONNECTIONS)]
+    for c in clients:
+        c.start()
+    for c in clients:
+        c.join()
+
+    time.sleep(2)
+    isatop.terminate()
+    isatop.wait()
+    server.close()
+
+    # Every flow must occupy at most one row in each period and appear at least once
+    out_files = [file for file in os.listdir(out_dir) if file.startswith('out-')]
+    seen = {port: 0 for port in ports}
+    failed = False
+    for file in out_files:
+        with open(f"{out_dir}/{file}") as f:
+            rows = f.readlines()
+        for port in ports:
+            count = sum(1 for row in rows if f"127.0.0.1:{port} " in row and f"127.0.0.1:{SERVER_PORT}" in row)
+            if count > 1:
+                print(f"{file}: flow with port {port} split into {count} rows")
+                failed = True
+            seen[port] += count
+
+    for port, count in seen.items():
+        if count == 0:
+            print(f"flow with port {port} not captured")
+            failed = True
+
+    print("FAIL" if failed else "OK")
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main(sys.argv))
@@ -0,0 +1,166 @@
+/**
+ * @file link_type_test.cpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Link-type decoders identify the same flows as the ethernet decoder.
+ *
+ * Every ethernet frame of the capture files is rewritten to the other supported link types
+ * (linux cooked capture v1/v2, raw ip, BSD loopback in both byte orders), the decoder selected
+ * for the link type must return the same status and flow record as the ethernet decoder.
+ *
+ * Usage: link_type_test capture.pcap ...
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <pcap.h>
+#include <netinet/in.h>
+#include <netinet/if_ether.h>
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+
+#include "../flow_table.hpp"
+#include "../capturing_utils.hpp"
+#include "test_utils.hpp"
+
+#define ETHER_SIZE 14 // octets
+
+/**
+ * @brief Frame of the link type carrying the network layer packet of the ethernet frame.
+ *
+ * @param link_type DLT_ value
+ * @param ether_type ethertype of the ethernet frame
+ * @param payload network layer packet
+ * @return std::vector<u_char>
+ */
+std::vector<u_char> rewriteFrame(int link_type, uint16_t ether_type, const std::vector<u_char> &payload)
+{
+    std::vector<u_char> header;
+    switch (link_type)
+    {
+    case DLT_LINUX_SLL:
+        header.assign(16, 0);
+        header[14] = ether_type >> 8;
+        header[15] = ether_type & 0xff;
+        break;
+    case DLT_LINUX_SLL2:
+        header.assign(20, 0);
+        header[0] = ether_type >> 8;
+        header[1] = ether_type & 0xff;
+        break;
+    case DLT_NULL: // host byte order
+    {
+        uint32_t family = ether_type == ETHERTYPE_IPV6 ? 30 : 2;
+        header.assign(4, 0);
+        memcpy(header.data(), &family, sizeof(family));
+        break;
+    }
+    case DLT_LOOP: // network byte order
+    {
+        uint32_t family = htonl(ether_type == ETHERTYPE_IPV6 ? 24 : 2);
+        header.assign(4, 0);
+        memcpy(header.data(), &family, sizeof(family));
+        break;
+    }
+    default: // DLT_RAW
+        break;
+    }
+
+    header.insert(header.end(), payload.begin(), payload.end());
+    return header;
+}
+
+/**
+ * @brief Compare results of two decoders.
+ *
+ * @return true if both returned the same status and, if valid, the same record
+ */
+bool sameResult(DecodeStatus expected_status, const FlowRecord &expected, DecodeStatus status, const FlowRecord &record)
+{
+    if (expected_status != status)
+        return false;
+    return status != DecodeStatus::VALID || (expected.key == record.key && expected.bytes == record.bytes);
+}
+
+/**
+ * @brief Check all link-type decoders on the ip frames of the capture file.
+ *
+ * @param file ethernet pcap file
+ * @return true if all decoders agree with the ethernet decoder
+ */
+bool checkCapture(const char *file)
+{
+    char error_buffer[PCAP_ERRBUF_SIZE];
+    pcap_t *handle = pcap_open_offline(file, error_buffer);
+    if (handle == nullptr)
+        throw std::invalid_argument(error_buffer);
+    if (pcap_datalink(handle) != DLT_EN10MB)
+    {
+        pcap_close(handle);
+        throw std::invalid_argument(std::string(file) + ": Not an ethernet capture");
+    }
+
+    const int link_types[] = {DLT_LINUX_SLL, DLT_LINUX_SLL2, DLT_RAW, DLT_NULL, DLT_LOOP};
+    const char *link_names[] = {"LINUX_SLL", "LINUX_SLL2", "RAW", "NULL", "LOOP"};
+
+    unsigned long long frames = 0;
+    unsigned long long failures = 0;
+    std::string mismatches; // frames decoded differently, shown if the check fails
+    struct pcap_pkthdr *packet_header;
+    const u_char *packet;
+    while (pcap_next_ex(handle, &packet_header, &packet) == 1)
+    {
+        if (packet_header->caplen < ETHER_SIZE)
+            continue;
+        uint16_t ether_type = (packet[12] << 8) | packet[13];
+        if (ether_type != ETHERTYPE_IP && ether_type != ETHERTYPE_IPV6) // raw and loopback links carry only ip
+            continue;
+        frames++;
+
+        FlowRecord expected;
+        DecodeStatus expected_status = decodeEthernet(packet_header, packet, expected);
+        std::vector<u_char> payload(packet + ETHER_SIZE, packet + packet_header->caplen);
+
+        for (size_t i = 0; i < sizeof(link_types) / sizeof(link_types[0]); i++)
+        {
+            std::vector<u_char> frame = rewriteFrame(link_types[i], ether_type, payload);
+            struct pcap_pkthdr header = *packet_header;
+            header.caplen = frame.size();
+
+            FlowRecord record;
+            DecodeStatus status = decoderForLinkType(link_types[i])(&header, frame.data(), record);
+            if (!sameResult(expected_status, expected, status, record))
+            {
+                mismatches += "frame " + std::to_string(frames) + " decoded differently as " + link_names[i] + "\n";
+                failures++;
+            }
+        }
+    }
+    pcap_close(handle);
+
+    return check(std::string(file) + ": " + std::to_string(frames) + " ip frames", failures == 0,
+                 mismatches + std::to_string(failures) + " mismatches");
+}
+
+int main(int argc, char *argv[])
+{
+    bool ok = true;
+    for (int i = 1; i < argc; i++)
+    {
+        try
+        {
+            ok &= checkCapture(argv[i]);
+        }
+        catch (const std::exception &ex)
+        {
+            std::cerr << "Error: " << ex.what() << std::endl;
+            return 1;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,114 @@
+/**
+ * @file metrics_server_test.cpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Scrapes over the loopback get the last published period as OpenMetrics text.
+ *
+ * Server listens on an ephemeral loopback port, scrapes before and after a published period
+ * are checked for the status, content type and exact samples, other requests for the error status.
+ *
+ * Usage: metrics_server_test
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include <cstring>
+
+#include "../flow_table.hpp"
+#include "../capturing_utils.hpp"
+#include "../metrics_server.hpp"
+#include "test_utils.hpp"
+
+/**
+ * @brief Send the request to the server on the loopback and read the response until the server closes.
+ *
+ */
+std::string scrape(uint16_t port, const std::string &request)
+{
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(port);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (fd < 0 || connect(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+    {
+        if (fd >= 0)
+            close(fd);
+        return "";
+    }
+
+    send(fd, request.data(), request.size(), MSG_NOSIGNAL);
+    std::string response;
+    char buffer[4096];
+    ssize_t length;
+    while ((length = recv(fd, buffer, sizeof(buffer), 0)) > 0)
+        response.append(buffer, length);
+    close(fd);
+    return response;
+}
+
+bool contains(const std::string &text, const std::string &part)
+{
+    return text.find(part) != std::string::npos;
+}
+
+int main()
+{
+    bool ok = true;
+    MetricsServer server("127.0.0.1:0");
+    uint16_t port = server.port();
+    const std::string get = "GET /metrics HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+    std::string response = scrape(port, get);
+    ok &= check("empty", contains(response, "HTTP/1.1 200 OK\r\n") &&
+                         contains(response, "Content-Type: application/openmetrics-text; version=1.0.0; charset=utf-8\r\n") &&
+                         contains(response, "\r\n\r\n# EOF\n"), response);
+
+    IpAddress src = {}, dst = {};
+    inet_pton(AF_INET, "10.0.0.1", src.bytes);
+    inet_pton(AF_INET, "192.168.1.1", dst.bytes);
+    FlowSnapshot records;
+    records.push_back({FlowKey(src, 40000, dst, 53, IPPROTO_UDP, IpAddrClass::IPV4), FlowStats(5000000000ULL, 4000000, 120, 2)});
+    CaptureStats capture;
+    capture.received = 4000010;
+    capture.skipped[(size_t)DecodeStatus::UNSUPPORTED_NETWORK] = 2;
+    capture.packets[(size_t)TransportProtocol::UDP] = 4000002;
+    capture.bytes[(size_t)TransportProtocol::UDP] = 5000000120ULL;
+    server.publishPeriod(records, 2, capture);
+
+    response = scrape(port, get);
+    std::string labels = "{rank=\"1\",src=\"10.0.0.1\",src_port=\"40000\",dst=\"192.168.1.1\",dst_port=\"53\",protocol=\"udp\"}";
+    ok &= check("period", contains(response, "# TYPE isatop_flow_rx_bytes_per_second gauge\n") &&
+                          contains(response, "\nisatop_flow_rx_bytes_per_second" + labels + " 2500000000.000\n") &&
+                          contains(response, "\nisatop_flow_tx_packets_per_second" + labels + " 1.000\n") &&
+                          contains(response, "\nisatop_received_packets_total 4000010\n") &&
+                          contains(response, "\nisatop_skipped_packets_total{reason=\"not ip\"} 2\n") &&
+                          contains(response, "\nisatop_protocol_bytes_total{protocol=\"udp\"} 5000000120\n") &&
+                          response.compare(response.size() - 7, 7, "\n# EOF\n") == 0, response);
+
+    response = scrape(port, "GET /other HTTP/1.1\r\n\r\n");
+    ok &= check("not found", response.compare(0, 22, "HTTP/1.1 404 Not Found") == 0, response);
+    response = scrape(port, "POST /metrics HTTP/1.1\r\n\r\n");
+    ok &= check("method", response.compare(0, 31, "HTTP/1.1 405 Method Not Allowed") == 0, response);
+
+    bool thrown = false;
+    try
+    {
+        MetricsServer invalid("127.0.0.1");
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    ok &= check("invalid address", thrown);
+    return ok ? 0 : 1;
+}
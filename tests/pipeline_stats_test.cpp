@@ -0,0 +1,160 @@
+/**
+ * @file pipeline_stats_test.cpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Pipeline counters account every replayed packet and latency buckets bound their values.
+ *
+ * Every latency up to 2^40 ns must fall into a bucket whose limit is within 25 % above it,
+ * buckets must be ordered. Packets handled with pauses between them must be timed each on its
+ * own, a packet waiting for its batch must not share its latency with the others in the batch.
+ * Each capture file is replayed, every received packet must be counted as accounted or skipped
+ * and handled exactly once in the latency histogram, and the flow table counters must not exceed
+ * the accounted packets.
+ *
+ * Usage: pipeline_stats_test capture.pcap ...
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <netinet/in.h>
+
+#include <iostream>
+#include <string>
+#include <stdexcept>
+#include <algorithm>
+#include <thread>
+#include <chrono>
+
+#include "../flow_table.hpp"
+#include "../capturing_utils.hpp"
+#include "../flow_monitor.hpp"
+#include "test_utils.hpp"
+
+#define PAUSE_MS 10 // between the handled packets, far above the handler latency
+
+/**
+ * @brief Check the bucket of every value near the bucket edges.
+ *
+ * @return bool all values are bounded
+ */
+bool checkBuckets()
+{
+    size_t previous = 0;
+    unsigned long long checked = 0; // values up to checked were checked in order
+    for (unsigned long long base = 1; base <= (1ULL << 40); base <<= 1)
+    {
+        for (unsigned long long ns = std::max(base - 1, checked); ns <= base + base / 2 + 1; ns += base / 8 + 1)
+        {
+            size_t bucket = latencyBucket(ns);
+            unsigned long long limit = latencyBucketLimit(bucket);
+            bool ordered = bucket >= previous && bucket < LATENCY_BUCKETS;
+            bool bounded = limit >= ns && limit - ns <= ns / 4 && (bucket == 0 || latencyBucketLimit(bucket - 1) < ns);
+            if (!ordered || !bounded)
+                return check("buckets", false, "bucket of " + std::to_string(ns) + " ns: " + std::to_string(bucket) +
+                                               " up to " + std::to_string(limit) + " ns");
+            previous = bucket;
+            checked = ns + 1;
+        }
+    }
+    return check("buckets", true);
+}
+
+/**
+ * @brief Decoder of the test packets, the first octet tells whether the packet is accounted.
+ *
+ */
+DecodeStatus decodeTest(const struct pcap_pkthdr *header, const u_char *packet, FlowRecord &record)
+{
+    if (packet[0] == 0)
+        return DecodeStatus::UNSUPPORTED_NETWORK;
+    IpAddress src = {}, dst = {};
+    src.bytes[0] = packet[0];
+    record.key = FlowKey(src, 1, dst, 2, IPPROTO_UDP, IpAddrClass::IPV4);
+    record.bytes = header->len;
+    return DecodeStatus::VALID;
+}
+
+/**
+ * @brief Handle an accounted packet, pause, a skipped packet, pause and an accounted packet in one batch.
+ *
+ * The first packet waits for its batch through both pauses, the skipped one is done when its
+ * handler returns, the last one is applied right away. Latency averaged over the batch would
+ * put all of them above the pause.
+ *
+ * @return bool the first packet alone is above the pause
+ */
+bool checkPerPacket()
+{
+    FlowTable table(16);
+    DecodeCounters counters;
+    CaptureContext context(&table, decodeTest, &counters, true);
+    struct pcap_pkthdr header = {};
+    header.caplen = header.len = 100;
+    const u_char accounted[] = {1}, skipped[] = {0}, last[] = {2};
+
+    packet_handler((u_char *)&context, &header, accounted);
+    std::this_thread::sleep_for(std::chrono::milliseconds(PAUSE_MS));
+    packet_handler((u_char *)&context, &header, skipped);
+    std::this_thread::sleep_for(std::chrono::milliseconds(PAUSE_MS));
+    packet_handler((u_char *)&context, &header, last);
+    flushCaptureBatch(&context);
+
+    CaptureStats stats;
+    for (size_t i = 0; i < LATENCY_BUCKETS; i++)
+        stats.latency[i] = counters.latency[i].load(std::memory_order_relaxed);
+    const unsigned long long pause_ns = PAUSE_MS * 1000000ULL;
+    bool ok = stats.latencyPercentile(0.5) < pause_ns && stats.latencyPercentile(0.9) >= 2 * pause_ns;
+    return check("per packet", ok, "p50 " + std::to_string(stats.latencyPercentile(0.5)) + " ns max " +
+                                   std::to_string(stats.latencyPercentile(1.0)) + " ns");
+}
+
+/**
+ * @brief Replay the capture file and check that the pipeline counters account every packet.
+ *
+ * @param file
+ * @return bool counters are consistent
+ */
+bool checkReplay(const char *file)
+{
+    CaptureOptions options = {};
+    options.file = file;
+    options.threads = 1;
+    options.backend = CaptureBackend::PCAP;
+    options.snaplen = 128;
+    options.timeout = 1000;
+    options.timed = true;
+    FlowMonitor monitor(options, SortKey::BYTES, 65536, 10, 0);
+    monitor.start();
+    monitor.getData();
+
+    CaptureStats stats = monitor.getCaptureStats();
+    unsigned long long received = monitor.getPacketCount();
+    unsigned long long handled = 0;
+    for (unsigned long long count : stats.latency)
+        handled += count;
+    unsigned long long packets = stats.packetsTotal();
+
+    bool ok = packets + stats.skippedTotal() == received && handled == received &&
+              stats.inserted + stats.rejected <= packets && (packets == 0 || stats.inserted > 0) &&
+              stats.latencyPercentile(0.5) <= stats.latencyPercentile(0.99) &&
+              stats.latencyPercentile(0.99) <= stats.latencyPercentile(1.0);
+    return check(file, ok, "received " + std::to_string(received) + " accounted " + std::to_string(packets) +
+                           " handled " + std::to_string(handled) + " inserted " + std::to_string(stats.inserted));
+}
+
+int main(int argc, char *argv[])
+{
+    bool ok = checkBuckets();
+    ok &= checkPerPacket();
+    try
+    {
+        for (int i = 1; i < argc; i++)
+            ok &= checkReplay(argv[i]);
+    }
+    catch (const std::exception &ex)
+    {
+        std::cerr << "Error: " << ex.what() << std::endl;
+        return 1;
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,194 @@
+/**
+ * @file sketch_accuracy_test.cpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Top flows of the sketch mode agree with the exact mode within the documented error bounds.
+ *
+ * Every capture file is replayed as a single period into an exact flow table and into sketches.
+ * With enough counters for all flows the sketch mode must report the same top flows as the exact
+ * mode. With fewer counters than flows every monitored flow must satisfy
+ * count - error <= weight <= estimate <= count, estimate must exceed the weight by at most N / k
+ * and every flow heavier than N / k must be monitored, for both bytes and packets as the weight.
+ *
+ * Usage: sketch_accuracy_test capture.pcap ...
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include <pcap.h>
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <cstdint>
+#include <stdexcept>
+#include <algorithm>
+
+#include "../flow_table.hpp"
+#include "../flow_sketch.hpp"
+#include "../capturing_utils.hpp"
+
+#define TOP_FLOWS 10
+#define LARGE_SKETCH 1024
+
+typedef std::unordered_map<FlowKey, unsigned long long, FlowKeyHash> FlowWeights;
+
+/**
+ * @brief Valid packet records of the capture file.
+ *
+ * @param file pcap file
+ * @return std::vector<FlowRecord>
+ */
+std::vector<FlowRecord> captureRecords(const char *file)
+{
+    char error_buffer[PCAP_ERRBUF_SIZE];
+    pcap_t *handle = pcap_open_offline(file, error_buffer);
+    if (handle == nullptr)
+        throw std::invalid_argument(error_buffer);
+
+    PacketDecoder decode = decoderForLinkType(pcap_datalink(handle));
+    if (decode == nullptr)
+    {
+        pcap_close(handle);
+        throw std::invalid_argument(std::string(file) + ": Unsupported link type");
+    }
+
+    std::vector<FlowRecord> records;
+    struct pcap_pkthdr *packet_header;
+    const u_char *packet;
+    while (pcap_next_ex(handle, &packet_header, &packet) == 1)
+    {
+        FlowRecord record;
+        if (decode(packet_header, packet, record) == DecodeStatus::VALID)
+            records.push_back(record);
+    }
+    pcap_close(handle);
+    return records;
+}
+
+/**
+ * @brief Sketch mode table with counters for all flows reports the same top flows as exact mode.
+ *
+ */
+bool checkSameTop(const std::vector<FlowRecord> &records, SortKey sort_key)
+{
+    FlowTable exact(65536);
+    FlowTable sketch(65536, LARGE_SKETCH);
+    exact.setSortKey(sort_key);
+    sketch.setSortKey(sort_key);
+    exact.setTopFlows(TOP_FLOWS);
+    sketch.setTopFlows(TOP_FLOWS);
+    for (const FlowRecord &record : records)
+    {
+        exact.addOrUpdateRecord(record.key, record.bytes);
+        sketch.addOrUpdateRecord(record.key, record.bytes);
+    }
+
+    FlowSnapshot expected;
+    FlowSnapshot actual;
+    exact.getStatistics(expected);
+    sketch.getStatistics(actual);
+    if (expected.size() != actual.size())
+        return false;
+
+    // Flows with equal rank value may be ordered differently, compare rank values and statistics of keys
+    std::unordered_map<FlowKey, FlowStats, FlowKeyHash> expected_stats;
+    for (const std::pair<FlowKey, FlowStats> &record : expected)
+        expected_stats[record.first] = record.second;
+    auto expected_it = expected.begin();
+    for (const std::pair<FlowKey, FlowStats> &record : actual)
+    {
+        if (rankValue(record.second, sort_key) != rankValue((expected_it++)->second, sort_key))
+            return false;
+        auto found = expected_stats.find(record.first);
+        if (found != expected_stats.end() &&
+            (found->second.rx_bytes != record.second.rx_bytes || found->second.tx_bytes != record.second.tx_bytes ||
+             found->second.rx_packets != record.second.rx_packets || found->second.tx_packets != record.second.tx_packets))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Small sketch keeps the error bounds.
+ *
+ * @param records packets of the period
+ * @param sort_key weight of the packets
+ * @param counters number of Space-Saving counters
+ * @return true if all bounds hold
+ */
+bool checkBounds(const std::vector<FlowRecord> &records, SortKey sort_key, size_t counters)
+{
+    FlowSketch sketch(counters);
+    FlowWeights weights;
+    for (FlowRecord record : records)
+    {
+        bool reversed = record.key.canonicalize();
+        sketch.add(record.key, reversed, record.bytes, sort_key);
+        weights[record.key] += sort_key == SortKey::BYTES ? record.bytes : 1;
+    }
+
+    unsigned long long total = sketch.totalWeight();
+    unsigned long long bound = total / counters;
+    FlowWeights monitored;
+    unsigned long long max_error = 0;
+    for (size_t i = 0; i < sketch.size(); i++)
+    {
+        const SketchCounter &counter = sketch.counter(i);
+        unsigned long long weight = weights[counter.key];
+        unsigned long long estimate = sketch.estimate(counter);
+        monitored[counter.key] = estimate;
+        if (counter.count - counter.error > weight || weight > estimate || estimate > counter.count || estimate - weight > bound)
+            return false;
+        max_error = std::max(max_error, estimate - weight);
+    }
+    for (const std::pair<const FlowKey, unsigned long long> &flow : weights)
+    {
+        if (flow.second > bound && monitored.count(flow.first) == 0)
+            return false;
+    }
+
+    std::cout << "  " << (sort_key == SortKey::BYTES ? "bytes" : "packets") << " k=" << counters << ": flows=" << weights.size()
+              << " N=" << total << " N/k=" << bound << " max_error=" << max_error << std::endl;
+    return true;
+}
+
+/**
+ * @brief Run all checks on the capture file.
+ *
+ * @param file
+ * @return true if all passed
+ */
+bool checkCapture(const char *file)
+{
+    std::vector<FlowRecord> records = captureRecords(file);
+    bool ok = true;
+    const SortKey keys[] = {SortKey::BYTES, SortKey::PACKETS};
+    for (SortKey sort_key : keys)
+    {
+        ok &= checkSameTop(records, sort_key);
+        for (size_t counters = 2; counters <= 8; counters *= 2)
+            ok &= checkBounds(records, sort_key, counters);
+    }
+    std::cout << file << ": " << records.size() << " packets" << (ok ? " OK" : " FAIL") << std::endl;
+    return ok;
+}
+
+int main(int argc, char *argv[])
+{
+    bool ok = true;
+    for (int i = 1; i < argc; i++)
+    {
+        try
+        {
+            ok &= checkCapture(argv[i]);
+        }
+        catch (const std::exception &ex)
+        {
+            std::cerr << "Error: " << ex.what() << std::endl;
+            return 1;
+        }
+    }
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,45 @@
+/**
+ * @file test_utils.hpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Reporting of the checks shared by the tests.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef TEST_UTILS_HPP
+#define TEST_UTILS_HPP
+
+#include <iostream>
+#include <string>
+
+/**
+ * @brief Print result of the check, show the detail if it failed.
+ *
+ * @param name
+ * @param ok
+ * @param detail e.g. the response which failed the check
+ * @return bool ok
+ */
+inline bool check(const std::string &name, bool ok, const std::string &detail = "")
+{
+    std::cout << name << (ok ? " OK" : " FAIL") << std::endl;
+    if (!ok && !detail.empty())
+        std::cout << detail << std::endl;
+    return ok;
+}
+
+/**
+ * @brief Print result of comparing the texts, show both if they differ.
+ *
+ * @param name
+ * @param actual
+ * @param expected
+ * @return bool texts are equal
+ */
+inline bool checkText(const std::string &name, const std::string &actual, const std::string &expected)
+{
+    return check(name, actual == expected, "expected:\n" + expected + "actual:\n" + actual);
+}
+
+#endif
@@ -0,0 +1,248 @@
+/**
+ * @file tpacket_capture.cpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Native AF_PACKET TPACKET_V3 memory-mapped ring capture.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#include "tpacket_capture.hpp"
+
+#include <sys/socket.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+#include <linux/filter.h>
+#include <unistd.h>
+
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+
+#define FRAME_SIZE 2048       // octets, only used to size the ring, V3 frames are variable length
+#define BLOCK_RETIRE_TIMEOUT 100 // ms, partially filled block is passed to the process after the timeout
+
+/**
+ * @brief Error of the failed system call.
+ *
+ * @param what description of the failed operation
+ * @return std::runtime_error
+ */
+static std::runtime_error systemError(const std::string &what)
+{
+    return std::runtime_error(what + ": " + strerror(errno));
+}
+
+/**
+ * @brief Open packet socket bound to the interface and map its receive ring.
+ *
+ * @param interface interface to capture packets on, "any" for all interfaces
+ * @param block_size_ size of one ring block in octets, multiple of the page size
+ * @param block_count_ number of ring blocks
+ * @param timeout poll timeout in ms
+ * @param fanout_group PACKET_FANOUT group id, negative if fanout is not used
+ * @param filter kernel filter compiled for DLT_RAW, nullptr to receive all packets
+ */
+TpacketRing::TpacketRing(const char *interface, size_t block_size_, size_t block_count_, int timeout, int fanout_group,
+                         const struct bpf_program *filter)
+    : fd(-1), ring(nullptr), block_size(block_size_), block_count(block_count_), poll_timeout(timeout),
+      loopback_index((int)if_nametoindex("lo")), stop_requested(false)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (block_size < FRAME_SIZE || block_size % page_size != 0 || block_count == 0)
+        throw std::invalid_argument("Ring block size must be multiple of " + std::to_string(page_size) + " octets");
+
+    unsigned int ifindex = 0; // all interfaces
+    if (strcmp(interface, "any") != 0)
+    {
+        ifindex = if_nametoindex(interface);
+        if (ifindex == 0)
+            throw std::invalid_argument(std::string(interface) + ": No such device exists");
+    }
+
+    try
+    {
+        // Link layer header is removed, packets are received only after bind, when the filter is attached
+        fd = socket(AF_PACKET, SOCK_DGRAM, 0);
+        if (fd < 0)
+            throw systemError("Cannot open packet socket");
+
+        if (filter != nullptr)
+        {
+            struct sock_fprog program;
+            program.len = filter->bf_len;
+            program.filter = (struct sock_filter *)filter->bf_insns; // same layout as bpf_insn
+            if (setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) != 0)
+                throw systemError("Cannot attach packet filter");
+        }
+
+        int version = TPACKET_V3;
+        if (setsockopt(fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) != 0)
+            throw systemError("Cannot set TPACKET_V3");
+
+        struct tpacket_req3 request;
+        memset(&request, 0, sizeof(request));
+        request.tp_block_size = block_size;
+        request.tp_block_nr = block_count;
+        request.tp_frame_size = FRAME_SIZE;
+        request.tp_frame_nr = (block_size / FRAME_SIZE) * block_count;
+        request.tp_retire_blk_tov = BLOCK_RETIRE_TIMEOUT;
+        if (setsockopt(fd, SOL_PACKET, PACKET_RX_RING, &request, sizeof(request)) != 0)
+            throw systemError("Cannot create receive ring");
+
+        void *mapped = mmap(nullptr, block_size * block_count, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        if (mapped == MAP_FAILED)
+            throw systemError("Cannot map receive ring");
+        ring = (uint8_t *)mapped;
+
+        struct sockaddr_ll address;
+        memset(&address, 0, sizeof(address));
+        address.sll_family = AF_PACKET;
+        address.sll_protocol = htons(ETH_P_ALL);
+        address.sll_ifindex = ifindex;
+        if (bind(fd, (struct sockaddr *)&address, sizeof(address)) != 0)
+            throw systemError("Cannot bind packet socket");
+
+        if (ifindex != 0)
+        {
+            struct packet_mreq membership;
+            memset(&membership, 0, sizeof(membership));
+            membership.mr_ifindex = ifindex;
+            membership.mr_type = PACKET_MR_PROMISC;
+            if (setsockopt(fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &membership, sizeof(membership)) != 0)
+                throw systemError("Cannot enable promiscuous mode");
+        }
+
+        if (fanout_group >= 0)
+        {
+            int fanout = fanout_group | ((PACKET_FANOUT_HASH | PACKET_FANOUT_FLAG_DEFRAG) << 16);
+            if (setsockopt(fd, SOL_PACKET, PACKET_FANOUT, &fanout, sizeof(fanout)) != 0)
+                throw systemError("Cannot join packet fanout group");
+        }
+    }
+    catch (...)
+    {
+        close();
+        throw;
+    }
+}
+
+TpacketRing::~TpacketRing()
+{
+    close();
+}
+
+/**
+ * @brief Unmap the ring and close the socket.
+ *
+ */
+void TpacketRing::close()
+{
+    if (ring != nullptr)
+    {
+        munmap(ring, block_size * block_count);
+        ring = nullptr;
+    }
+    if (fd >= 0)
+    {
+        ::close(fd);
+        fd = -1;
+    }
+}
+
+/**
+ * @brief Pass frames of the filled blocks to the handler until breakloop is called.
+ *
+ * @param handler packet handler
+ * @param context handler arguments
+ */
+void TpacketRing::loop(pcap_handler handler, CaptureContext *context)
+{
+    size_t current = 0;
+    struct pollfd descriptor;
+    descriptor.fd = fd;
+    descriptor.events = POLLIN | POLLERR;
+
+    while (!stop_requested.load(std::memory_order_relaxed))
+    {
+        struct tpacket_block_desc *block = (struct tpacket_block_desc *)(ring + current * block_size);
+
+        // Block owned by the kernel, wait until it is retired
+        if ((__atomic_load_n(&block->hdr.bh1.block_status, __ATOMIC_ACQUIRE) & TP_STATUS_USER) == 0)
+        {
+            descriptor.revents = 0;
+            poll(&descriptor, 1, poll_timeout);
+            continue;
+        }
+
+        uint32_t packets = block->hdr.bh1.num_pkts;
+        const uint8_t *frame = (const uint8_t *)block + block->hdr.bh1.offset_to_first_pkt;
+        for (uint32_t i = 0; i < packets; i++)
+        {
+            const struct tpacket3_hdr *header = (const struct tpacket3_hdr *)frame;
+            const struct sockaddr_ll *link = (const struct sockaddr_ll *)(frame + TPACKET_ALIGN(sizeof(struct tpacket3_hdr)));
+            if (link->sll_pkttype == PACKET_OUTGOING && link->sll_ifindex == loopback_index)
+            {
+                // Same packet is delivered once more as incoming, count it only once like libpcap
+                frame += header->tp_next_offset;
+                continue;
+            }
+
+            uint16_t protocol = ntohs(link->sll_protocol);
+            if (protocol != ETH_P_IP && protocol != ETH_P_IPV6)
+            {
+                if (context->counters != nullptr)
+                    context->counters->count(DecodeStatus::UNSUPPORTED_NETWORK);
+                frame += header->tp_next_offset;
+                continue;
+            }
+
+            // Link header differs between devices (e.g. on "any"), the socket passes only the network layer packet
+            struct pcap_pkthdr packet_header;
+            packet_header.ts.tv_sec = header->tp_sec;
+            packet_header.ts.tv_usec = header->tp_nsec / 1000;
+            packet_header.caplen = header->tp_snaplen;
+            packet_header.len = header->tp_len;
+
+            handler((u_char *)context, &packet_header, frame + header->tp_net);
+            frame += header->tp_next_offset;
+        }
+        flushCaptureBatch(context);
+
+        // Return the block to the kernel
+        __atomic_store_n(&block->hdr.bh1.block_status, TP_STATUS_KERNEL, __ATOMIC_RELEASE);
+        current = (current + 1) % block_count;
+    }
+}
+
+/**
+ * @brief Stop the capturing loop, takes effect within the poll timeout.
+ *
+ */
+void TpacketRing::breakloop()
+{
+    stop_requested.store(true, std::memory_order_relaxed);
+}
+
+/**
+ * @brief Ring counters since the socket was opened.
+ *
+ * @return CaptureStats
+ */
+CaptureStats TpacketRing::stats()
+{
+    struct tpacket_stats_v3 kernel_stats;
+    socklen_t length = sizeof(kernel_stats);
+    if (getsockopt(fd, SOL_PACKET, PACKET_STATISTICS, &kernel_stats, &length) == 0)
+    {
+        // tp_packets already includes dropped packets
+        totals.received += kernel_stats.tp_packets;
+        totals.dropped += kernel_stats.tp_drops;
+    }
+    return totals;
+}
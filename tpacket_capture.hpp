@@ -0,0 +1,53 @@
+/**
+ * @file tpacket_capture.hpp
+ * @author Jan Pánek (xpanek11@stud.fit.vut.cz)
+ * @brief Native AF_PACKET TPACKET_V3 memory-mapped ring capture.
+ *
+ * @copyright Copyright (c) 2024
+ *
+ */
+
+#ifndef TPACKET_CAPTURE_HPP
+#define TPACKET_CAPTURE_HPP
+
+#include <pcap.h>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include "capturing_utils.hpp"
+
+/**
+ * @brief Packet socket with TPACKET_V3 receive ring.
+ *
+ * Kernel fills blocks of the ring shared with the process, whole block of frames is
+ * processed per wakeup and frames are passed to the handler in place, without copying.
+ * Handler receives ipv4 and ipv6 packets without the link layer header (as DLT_RAW),
+ * so the kernel filter must be compiled for DLT_RAW as well.
+ *
+ */
+class TpacketRing
+{
+private:
+    int fd;
+    uint8_t *ring;
+    size_t block_size;
+    size_t block_count;
+    int poll_timeout;
+    int loopback_index; // outgoing packets on loopback are also seen as incoming
+    std::atomic<bool> stop_requested;
+    CaptureStats totals; // Kernel counters are reset on every read
+
+    void close();
+public:
+    TpacketRing(const char *interface, size_t block_size_, size_t block_count_, int timeout, int fanout_group,
+                const struct bpf_program *filter);
+    ~TpacketRing();
+    TpacketRing(const TpacketRing &) = delete;
+    TpacketRing &operator=(const TpacketRing &) = delete;
+
+    void loop(pcap_handler handler, CaptureContext *context);
+    void breakloop();
+    CaptureStats stats();
+};
+
+#endif